@@ -0,0 +1,260 @@
+// benchmarks for myShell: microbenchmarks of the parser, and end-to-end runs of the
+// built shell. every result is printed as one JSON object per line, so runs can be
+// collected and compared across releases.
+//
+// in-process: compiling a typical line and a 20000-argument one into plans (parse_*),
+// a plan cache hit, expanding the long line's words (expand_long_line), a line of
+// aliased stages (parse_aliased_line), and globs over more directories than the listing
+// cache holds (glob_*, which also checks every file is matched), and 'pin' CPU lists
+// (parse_cpu_list, which also checks lists with an id out of range are rejected).
+// end to end: the latency of 'true', a 'for' loop of it, 3- and 5-stage pipelines of
+// 'yes | ... | head -c N', here-strings, and background job churn (e2e_*).
+//
+// usage: bench [path/to/myShell] (the end-to-end benchmarks are skipped without it)
+// the environment variables BENCH_SCALE (default 1) and BENCH_PIPE_BYTES (default 256M)
+// scale the iteration counts and the amount of data pushed through pipelines.
+
+#define MYSHELL_NO_MAIN
+#include "../main.cpp"
+
+double scale = 1; // multiplies every iteration count
+
+/* ---------- HELPERS ---------- */
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void report(const char* name, long iterations, double elapsed, const char* unit, double value) {
+  printf("{\"name\": \"%s\", \"iterations\": %ld, \"seconds\": %.6f, \"%s\": %.3f}\n", name,
+         iterations, elapsed, unit, value);
+  fflush(stdout);
+}
+
+// runs the shell with the given script on its STDIN and returns how long it took:
+double run_shell(const char* shell, const std::string& script) {
+  int fd[2];
+  pipe2(fd, O_CLOEXEC);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fd[0], STDIN_FILENO);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+  char* argv[] = {(char*) shell, NULL};
+  double start = now();
+  pid_t pid;
+  if (posix_spawn(&pid, shell, &actions, NULL, argv, environ)) {
+    fprintf(stderr, "bench: could not run %s\n", shell);
+    exit(1);
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  close(fd[0]);
+
+  // the script can be bigger than the pipe, so keep writing as the shell reads:
+  for (size_t done = 0; done < script.size();) {
+    ssize_t n = write(fd[1], script.data() + done, script.size() - done);
+    if (n <= 0) break;
+    done += n;
+  }
+  close(fd[1]);
+  waitpid(pid, NULL, 0);
+  return now() - start;
+}
+
+/* ---------- PARSER ---------- */
+
+// compiles a line into its plan without the plan cache, like the first time it's run:
+void bench_parse(const char* name, const std::string& line, long iterations) {
+  Plan plan;
+  parse_plan(line, plan); // warm up the allocator
+
+  double start = now();
+  for (long i = 0; i < iterations; i++) parse_plan(line, plan);
+  double elapsed = now() - start;
+  report(name, iterations, elapsed, "ns_per_line", elapsed * 1e9 / iterations);
+}
+
+// looks up a line that ran before (among PLAN_CACHE_MAX others):
+void bench_plan_cache(const std::string& line, long iterations) {
+  for (int i = 0; i < PLAN_CACHE_MAX; i++) compile_line(line + " " + std::to_string(i));
+  compile_line(line);
+
+  double start = now();
+  for (long i = 0; i < iterations; i++) compile_line(line);
+  double elapsed = now() - start;
+  report("plan_cache_hit", iterations, elapsed, "ns_per_line", elapsed * 1e9 / iterations);
+}
+
+// expands the words of a compiled command into its argument list, which is all that's
+// left to do when a cached line runs again:
+void bench_expand(const char* name, const std::string& line, long iterations) {
+  Plan plan;
+  parse_plan(line, plan);
+  const CommandPlan& command = plan.pipelines[0].stages[0];
+  Launch launch;
+  prepare_launch(command, launch);
+
+  double start = now();
+  for (long i = 0; i < iterations; i++) prepare_launch(command, launch);
+  double elapsed = now() - start;
+  report(name, iterations, elapsed, "MB_per_s", line.size() * iterations / elapsed / 1e6);
+}
+
+// compiles a pipeline whose stages start with aliases, against a table of many aliases
+// (most of which share prefixes with each other):
+void bench_aliases(long iterations) {
+  for (int i = 0; i < 500; i++) alias_set("g" + std::to_string(i), "git log -n " + std::to_string(i));
+  alias_set("gs", "git status --short");
+  Plan plan;
+  double start = now();
+  for (long i = 0; i < iterations; i++) parse_plan("gs | g42 | g499 | grep -v x", plan);
+  double elapsed = now() - start;
+  report("parse_aliased_line", iterations, elapsed, "ns_per_line", elapsed * 1e9 / iterations);
+}
+
+/* ---------- GLOBS ---------- */
+
+// matches globs over a tree with more directories than the listing cache holds, checking
+// that every file is found each time:
+void bench_glob(long iterations) {
+  char root[] = "/tmp/bench_glob.XXXXXX";
+  if (!mkdtemp(root)) return;
+  int dirs = DIR_CACHE_MAX * 2;
+  for (int i = 0; i < dirs; i++) {
+    std::string dir = std::string(root) + "/d" + std::to_string(i);
+    mkdir(dir.c_str(), 0700);
+    mkdir((dir + "/sub").c_str(), 0700);
+    close(open((dir + "/sub/x.c").c_str(), O_WRONLY | O_CREAT, 0600));
+  }
+
+  const char* patterns[] = {"/*/sub/*.c", "/**/*.c"};
+  for (const char* pattern : patterns) {
+    std::string path = root + std::string(pattern);
+    std::vector<std::string> matches;
+    double start = now();
+    for (long i = 0; i < iterations; i++) {
+      matches.clear();
+      glob(path.c_str(), matches);
+      if ((int) matches.size() != dirs) {
+        fprintf(stderr, "bench: %s matched %zu of %d files\n", pattern, matches.size(), dirs);
+        exit(1);
+      }
+    }
+    double elapsed = now() - start;
+    report(pattern[1] == '*' && pattern[2] == '*' ? "glob_globstar" : "glob_two_levels", iterations, elapsed,
+           "us_per_glob", elapsed * 1e6 / iterations);
+  }
+
+  for (int i = 0; i < dirs; i++) {
+    std::string dir = std::string(root) + "/d" + std::to_string(i);
+    unlink((dir + "/sub/x.c").c_str());
+    rmdir((dir + "/sub").c_str());
+    rmdir(dir.c_str());
+  }
+  rmdir(root);
+}
+
+/* ---------- CPU LISTS ---------- */
+
+// parses 'pin' CPU and node lists, checking ones with an id out of range anywhere in them
+// are rejected:
+void bench_cpu_lists(long iterations) {
+  cpu_set_t cpus;
+  unsigned long nodes;
+  const char* bad_cpus[] = {"9999,0", "0,1-5000", "0-3,1024,4"};
+  const char* bad_nodes[] = {"70,0", "0,1-70", "64,1"};
+  for (const char* list : bad_cpus) {
+    if (parse_cpu_set(list, cpus)) {
+      fprintf(stderr, "bench: CPU list %s was accepted\n", list);
+      exit(1);
+    }
+  }
+  for (const char* list : bad_nodes) {
+    if (parse_node_mask(list, nodes)) {
+      fprintf(stderr, "bench: node list %s was accepted\n", list);
+      exit(1);
+    }
+  }
+  if (!parse_node_mask("3,0-1", nodes) || nodes != 0xb) {
+    fprintf(stderr, "bench: node list 3,0-1 gave %lx\n", nodes);
+    exit(1);
+  }
+
+  double start = now();
+  for (long i = 0; i < iterations; i++) {
+    if (!parse_cpu_set("0-3,8,10-11,64-127", cpus)) exit(1);
+  }
+  double elapsed = now() - start;
+  report("parse_cpu_list", iterations, elapsed, "ns_per_list", elapsed * 1e9 / iterations);
+}
+
+/* ---------- END TO END ---------- */
+
+void bench_latency(const char* shell, long iterations) {
+  std::string script;
+  for (long i = 0; i < iterations; i++) script += "true\n";
+  double elapsed = run_shell(shell, script);
+  report("e2e_true_latency", iterations, elapsed, "us_per_cmd", elapsed * 1e6 / iterations);
+}
+
+// the same commands as bench_latency, but as the body of one loop (compiled once):
+void bench_loop(const char* shell, long iterations) {
+  std::string script = "for i in";
+  for (long i = 0; i < iterations; i++) script += " " + std::to_string(i);
+  script += "; do true $i; done\n";
+  double elapsed = run_shell(shell, script);
+  report("e2e_for_loop", iterations, elapsed, "us_per_iteration", elapsed * 1e6 / iterations);
+}
+
+void bench_pipeline(const char* shell, const char* name, const char* middle, long bytes) {
+  std::string script = "yes" + std::string(middle) + " | head -c " + std::to_string(bytes) + " | wc -c\n";
+  double elapsed = run_shell(shell, script);
+  report(name, 1, elapsed, "MB_per_s", bytes / elapsed / 1e6);
+}
+
+void bench_here_string(const char* shell, long iterations) {
+  std::string script;
+  for (long i = 0; i < iterations; i++) script += "cat <<< \"payload " + std::to_string(i) + "\"\n";
+  double elapsed = run_shell(shell, script);
+  report("e2e_here_string", iterations, elapsed, "us_per_cmd", elapsed * 1e6 / iterations);
+}
+
+void bench_jobs(const char* shell, long iterations) {
+  std::string script;
+  for (long i = 0; i < iterations; i++) script += "true &\n";
+  script += "wait\n";
+  double elapsed = run_shell(shell, script);
+  report("e2e_background_churn", iterations, elapsed, "jobs_per_s", iterations / elapsed);
+}
+
+int main(int argc, char** argv) {
+  if (getenv("BENCH_SCALE")) scale = atof(getenv("BENCH_SCALE"));
+  long pipe_bytes = getenv("BENCH_PIPE_BYTES") ? atol(getenv("BENCH_PIPE_BYTES")) : 256L << 20;
+
+  // a typical interactive line, and a generated one with thousands of arguments:
+  std::string typical = "git log --oneline --graph -n 50 | grep -v \"Merge branch\" | head -20 > /tmp/out.txt; ls -la";
+  std::string long_line = "printf \"%s\\n\"";
+  for (int i = 0; i < 20000; i++) long_line += " build/obj/module" + std::to_string(i) + ".o";
+  long_line += " | sort | uniq -c | sort -rn | head";
+
+  bench_parse("parse_typical_line", typical, 1000000 * scale);
+  bench_parse("parse_long_line", long_line, 200 * scale);
+  bench_plan_cache(typical, 1000000 * scale);
+  bench_expand("expand_long_line", long_line, 200 * scale);
+  bench_aliases(200000 * scale);
+  bench_glob(200 * scale);
+  bench_cpu_lists(200000 * scale);
+
+  if (argc < 2) return 0;
+  const char* shell = argv[1];
+  bench_latency(shell, 2000 * scale);
+  bench_loop(shell, 2000 * scale);
+  bench_pipeline(shell, "e2e_pipeline_3_stages", "", pipe_bytes);
+  bench_pipeline(shell, "e2e_pipeline_5_stages", " | cat - | cat -", pipe_bytes);
+  bench_here_string(shell, 2000 * scale);
+  bench_jobs(shell, 1000 * scale);
+  return 0;
+}
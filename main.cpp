@@ -1,16 +1,45 @@
+#include <cerrno> // for errno values reported by posix_spawn()
+#include <cstdarg> // for formatting into the terminal's output buffer
 #include <csignal> // for exit message upon CTRL+C
+#include <algorithm> // for std::max()
+#include <bitset> // for character sets in globs
+#include <climits> // for INT_MAX
+#include <cstdint> // for fixed-size integers in hashes and file headers
+#include <cctype> // for variable names
+#include <cstring> // for strchr()
+#include <ctime> // for timestamps of finished processes
+#include <poll.h> // for collecting the output of remote commands
 #include <fcntl.h> // for open() system call
-#include <iostream> // for basic i/o ops
+#include <list> // for the order of the plan cache
+#include <cstdio> // for printf()
+#include <dirent.h> // for listing the memo cache
 #include <map> // for color map
+#include <memory> // for plans shared by the cache and the line running them
+#include <sched.h> // for starting zygotes as our children
+#include <spawn.h> // for posix_spawn()
+#include <sys/sendfile.h> // for in-kernel copies from files
+#include <sys/socket.h> // for handing commands to zygotes
 #include <string> // for string ops
+#include <string_view> // for slices of the input line
+#include <sys/file.h> // for flock() on the history file
+#include <sys/mman.h> // for mapping script files and the history file
+#include <sys/resource.h> // for per-process resource usage
+#include <sys/syscall.h> // for getdents64()
+#include <sys/uio.h> // for writev()
+#include <sys/stat.h> // for stat() when searching $PATH
 #include <sys/wait.h> // for wait() call
+#include <termios.h> // for reading keys as they're pressed
 #include <unistd.h> // for fork(), exec(), etc.
+#include <unordered_map> // for the command path cache
+#include <unordered_set> // for what the rc file has set
 #include <vector> // for storing string tokens
 
-#define FILEFLAGS (O_CREAT | O_WRONLY | O_TRUNC | S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
-#define FILEFLAGS_APPEND (O_APPEND | O_WRONLY | S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
+#define FILEFLAGS (O_CREAT | O_WRONLY | O_TRUNC)
+#define FILEFLAGS_APPEND (O_CREAT | O_APPEND | O_WRONLY)
 #define RW_PERMS 0666
 
+extern char** environ; // passed to every spawned process (points into envp once variables are set up)
+
 // map of all supported colors for 'color' option:
 const std::map<std::string, std::string> COLORS = {
   {"red", "\x1b[0;31m"},
@@ -32,267 +61,5581 @@ const std::map<std::string, std::string> COLORS = {
 const std::string ERROR_STR[] = {
   "child process could not be created.\n",
   "unexpected error during process execution.\n",
-  "no such directory\n"
+  "no such directory\n",
+  "command not found.\n",
+  "could not open script file.\n"
+};
+
+// size of each read() when reading commands from a file descriptor:
+#define READ_CHUNK 65536
+
+// most bytes moved per system call by copy_fd():
+#define COPY_CHUNK (1 << 20)
+
+// buffer for reading directory entries in batches (enough for thousands of names per call):
+#define DIRENT_BUF (256 << 10)
+
+// how many directory listings are kept before the cache starts over (between walks of a
+// glob, which may need more):
+#define DIR_CACHE_MAX 64
+
+// the largest command (with its environment) handed to a zygote, and the most zygotes:
+#define ZYGOTE_MSG_MAX (64 << 10)
+#define ZYGOTE_MAX 64
+
+// the most descriptors handed to a zygote along with a command:
+#define ZYGOTE_FDS 8
+
+// the period cgroup CPU quotas are given in (in microseconds), so 'cpu=1' is one CPU:
+#define CPU_PERIOD 100000
+
+// the most aliases expanded into one another for a single command:
+#define ALIAS_DEPTH_MAX 32
+
+// bumped whenever the layout of the rc snapshot changes:
+#define RC_SNAPSHOT_VERSION 1
+
+// how many compiled lines are kept for running again:
+#define PLAN_CACHE_MAX 256
+
+// what launch_stage() returns when the redirections of a stage couldn't be done:
+#define REDIRECT_FAILED -2
+
+// events kept by the trace ring (a power of two), which drops the oldest ones beyond it:
+#define TRACE_EVENTS 16384
+
+// command names that get latency histograms of their own ('stats'). the rest share one
+// named "(other)", so the memory used stays bounded:
+#define STATS_COMMANDS 64
+
+// latencies are counted in log-linear buckets, like an HDR histogram: one per microsecond
+// below 32us, and then 16 for every power of two, so a bucket's values are within 6% of
+// each other. the last one also holds everything past 2^41us (25 days):
+#define HIST_BUCKETS (32 + 36 * 16)
+
+// the longest single argument Linux takes (MAX_ARG_STRLEN), and the room 'batch' leaves
+// in every exec of ARG_MAX (like xargs does):
+#define ARG_STRLEN_MAX (32 * 4096)
+#define ARG_HEADROOM 2048
+
+// NUMA memory policies for set_mempolicy() (from <numaif.h>, which comes with libnuma):
+#define MPOL_PREFERRED 1
+#define MPOL_BIND 2
+
+// how long an idle ssh control connection stays up for the next '@hosts' command:
+#define SSH_PERSIST "10m"
+
+// where input lines come from: a file descriptor read through a large buffer, or a
+// block of memory (a mapped script file or the string given to '-c'):
+struct LineReader {
+  int fd = -1; // -1 if reading from memory
+  std::vector<char> buf; // buffered input, when reading from fd
+  const char* data = NULL; // start of the input not yet returned
+  size_t len = 0; // number of bytes at data
+};
+
+bool interactive = false; // reading commands from a terminal (prompts and job notices)
+pid_t shell_pid = 0; // the shell itself, as opposed to a child that exits through exit() too
+std::string terminal_out; // what the shell has to say before it next draws the prompt (job notices)
+std::string text_color; // set by 'color', and put back by every prompt (in case a command changed it)
+int last_status = 0; // exit status of the last command run
+volatile sig_atomic_t copy_interrupted = 0; // set by CTRL+C while the shell itself copies data
+long pipe_size = 0; // capacity asked for every new pipe ('set pipesize'), 0 for the kernel's default
+long memo_size = 64L << 20; // the memo cache evicts its oldest entries beyond this ('set memosize')
+long fanout = 16; // hosts an '@hosts' command runs on at the same time ('set fanout')
+long tracing = 0; // whether events go to the trace ring ('set trace on', or $MYSHELL_TRACE)
+long stats_interval = 60; // seconds between writes of the stats to $MYSHELL_STATS ('set statsinterval')
+long autobatch = 0; // whether a command with too many arguments is run in batches ('set autobatch on')
+bool batching = false; // running the batches of a command, which don't get batched again
+std::string trace_file; // where $MYSHELL_TRACE wants the trace written when we exit
+
+// every memo cache entry starts with this, followed by the command's output:
+struct MemoHeader {
+  char magic[4]; // "MEMO"
+  int32_t status; // exit status of the command
+  int64_t size; // bytes of output following the header
+};
+
+// the history file, mapped into memory. other sessions append to it too, so the mapping
+// is refreshed (and the index extended) whenever the file has grown:
+struct History {
+  int fd = -1;
+  const char* data = NULL; // the mapped file
+  size_t len = 0; // bytes mapped
+  std::vector<size_t> ends; // offset of the '\n' ending each entry, built on first use
+  size_t indexed = 0; // bytes of data already covered by ends
+} history;
+
+// what the memo cache did during this session (see 'memo --stats'):
+struct MemoStats {
+  long hits = 0, misses = 0, uncached = 0, evicted = 0;
+} memo_stats;
+
+// an entry of the command path cache (see the 'hash' builtin):
+struct HashedPath {
+  std::string path; // absolute path of the executable
+  int hits = 0; // number of times the command was looked up
+};
+
+// command name -> absolute path, filled the first time a command is run:
+std::unordered_map<std::string, HashedPath> path_cache;
+
+// a shell variable, kept as the "NAME=value" string handed to commands if exported:
+struct Variable {
+  std::string entry;
+  size_t name_len = 0;
+  int env_index = -1; // where entry is in envp, -1 if it isn't exported
+};
+
+// every variable, and the environment made of the exported ones. envp is changed in place
+// as variables are set, so spawning a command never rebuilds it:
+std::unordered_map<std::string, Variable> variables;
+std::vector<char*> envp; // NULL-terminated
+
+// the entries of a directory, as used for globs and tab completion:
+struct DirListing {
+  struct timespec mtime = {}; // of the directory when it was read
+  std::vector<std::string> names; // sorted, for finding every name with a prefix
+  std::vector<bool> dirs; // whether each entry is a directory (or a link to one)
+  std::vector<bool> links; // whether each entry is a symbolic link
+};
+
+// the layout of the entries getdents64() returns:
+struct linux_dirent64 {
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+// one step of a compiled glob pattern:
+struct GlobStep {
+  enum { CHAR, ANY, STAR, SET } kind;
+  unsigned char c = 0; // for CHAR
+  std::bitset<256> set; // for SET ('[...]')
+  bool matches(unsigned char ch) const {
+    return kind == ANY || (kind == CHAR && ch == c) || (kind == SET && set[ch]);
+  }
+};
+
+// a path component of a glob, compiled:
+struct GlobPattern {
+  std::vector<GlobStep> steps;
+  std::string prefix; // the literal text before the first wildcard
+  bool literal = false; // no wildcards at all
+  bool globstar = false; // the component is just '**'
+  bool dot = false; // starts with '.', so it may match hidden files
+};
+
+// directory path -> its entries, read again only when the directory has changed:
+std::unordered_map<std::string, DirListing> dir_cache;
+int dir_walks = 0; // globs being matched, which hold on to listings in the cache
+
+// a word of a compiled command line, as written and with its quotation marks dropped
+// (which is all that's needed to run it, unless it has variables):
+struct Word {
+  std::string raw;
+  std::string literal;
+  bool expand = false; // has a '$', so it's expanded every time it runs
+  bool quoted = false; // quoted words are kept even when they expand to nothing
+  bool wildcard = false; // has an unquoted '*', '?' or '[', so it's a glob
+};
+
+enum RedirectKind { REDIRECT_FILE, REDIRECT_COPY, REDIRECT_HERE_STRING, REDIRECT_HERE_DOC };
+
+// a redirection as written: '[N]> file', '[N]>> file', '[N]< file', 'N>&M', '<<< text' or '<<WORD'
+struct RedirectPlan {
+  RedirectKind kind = REDIRECT_FILE;
+  int fd = -1; // the descriptor it redirects
+  int flags = 0; // open() flags, for a file
+  Word target; // the file, the here-string or the descriptor copied
+  int heredoc = -1; // which of the line's here-documents, for '<<'
+};
+
+// a stage of a pipeline: a simple command, or a subshell ('( list )'):
+struct CommandPlan {
+  std::vector<Word> words;
+  std::vector<RedirectPlan> redirects; // in the order they're done
+  int subshell = -1; // the step the subshell's list starts at, if it's one
+  Word cpus; // the CPUs given by the '|@cpus' before it, if any
+  bool loop = false; // the subshell is a loop, which runs in the shell itself when it's alone
+  bool assignments = false; // nothing but 'NAME=value' words, so it sets variables in the shell
+  size_t env_words = 0; // the 'NAME=value' words before its command, for its environment only
+  std::string text; // for the job table
+};
+
+struct PipelinePlan {
+  std::vector<CommandPlan> stages;
+  std::string text;
+};
+
+// what a step of a plan does. the body of a step (the steps it runs) comes right after
+// it, and every list ends with STEP_END:
+enum StepOp {
+  STEP_PIPELINE, // runs pipelines[arg]
+  STEP_AND, STEP_OR, // go to step arg unless the last status was zero ('&&') or non-zero ('||')
+  STEP_ASYNC, // runs its body (a list) in the background ('&')
+  STEP_TIME, STEP_MEMO, STEP_LIMIT, // run their body (one command) with args as options
+  STEP_PAR, // runs the lists starting at members concurrently
+  STEP_FOR, // runs its body (a list) once for each of args, with the variable name set to it
+  STEP_WHILE, STEP_UNTIL, // run the list at arg for as long as their body (a list) succeeds (or fails)
+  STEP_REPEAT, // runs its body (one command) args[0] times
+  STEP_REMOTE, // runs the text of its body (one pipeline) over ssh on each of the hosts in args[0]
+  STEP_PIN, // runs its body (one pipeline) on the CPUs (and NUMA nodes) in args
+  STEP_END
+};
+
+struct Step {
+  StepOp op;
+  int arg = -1;
+  int next = -1; // the step after this one and its body
+  std::vector<Word> args;
+  std::vector<int> members;
+  std::vector<std::string> texts; // of the body (for '&'), or of each member (for 'par')
+  std::string name; // the variable of a 'for'
+};
+
+// a compiled command line, which runs without looking at its text again:
+struct Plan {
+  std::vector<Step> steps; // the line's list starts at step 0
+  std::vector<PipelinePlan> pipelines;
+  std::vector<std::string> heredocs; // the delimiter of each '<<', in order
+  std::string error; // the syntax error, if the line has one
+  size_t alias_generation = 0; // of the aliases it was parsed with
+};
+
+enum TokenType { TOKEN_WORD, TOKEN_PIPE, TOKEN_AND, TOKEN_OR, TOKEN_AMP, TOKEN_SEMI, TOKEN_OPEN,
+                 TOKEN_CLOSE, TOKEN_REDIRECT, TOKEN_END };
+
+struct Token {
+  TokenType type;
+  std::string_view text; // for a redirection, the operator without its descriptor
+  int fd = -1; // the descriptor written before a redirection ('2>'), -1 if none
+  int chain = 0; // the aliases expanded to get here (an index into Parser::chains)
+};
+
+// the state of parsing a line into a plan:
+struct Parser {
+  Plan* plan;
+  std::vector<Token> tokens;
+  size_t pos = 0;
+  std::vector<std::vector<std::string>> chains = {{}}; // names of the aliases a token came from
+  int groups = 0; // 'par' groups we're in, which a '}' word ends
+  int loops = 0; // loops we're in, whose lists a 'do' or 'done' ends
+  bool failed = false;
+};
+
+// compiled lines, most recently used first, and where each one is in that list:
+std::list<std::pair<std::string, std::shared_ptr<const Plan>>> plan_lru;
+std::unordered_map<std::string_view, decltype(plan_lru)::iterator> plan_cache;
+size_t alias_generation = 0; // bumped whenever an alias changes, which makes every plan stale
+
+// a redirection of a command to be launched, with its target expanded:
+struct Redirect {
+  int fd;
+  int flags = 0; // open() flags, for a file
+  const char* path = NULL; // the file (in the Launch's buf), if it's one
+  int copy_of = -1; // the descriptor it becomes a copy of ('2>&1'), if it's one
+  bool here = false; // whether it reads here_text instead ('<<<' and '<<')
+  std::string_view here_text; // the here-string (in buf) or the here-document's body
+  bool here_newline = false; // here-strings get a newline added, like in other shells
 };
 
+// a command that has been expanded and prepared for launching by the parent.
+// its words are written NUL-terminated into buf, which is reused from stage to stage:
+struct Launch {
+  std::vector<char> buf; // arena holding the text of every word
+  std::vector<char*> argv; // NULL-terminated argument list, pointing into buf
+  std::vector<Redirect> redirects;
+  std::vector<int> glob_args; // arguments with unquoted wildcards, in order
+  std::vector<std::string> matches; // the paths they expanded to, which argv points into
+  const struct Limits* limits = NULL; // resource limits to apply before the exec, if any
+  const struct Placement* placement = NULL; // the CPUs and memory to run on, if it's pinned
+  std::vector<char*> assigns; // the 'NAME=value' words before the command (in buf)
+  std::vector<char*> env; // the environment with those in it (NULL-terminated), if any
+};
+
+// the bodies of the here-documents of the line being run, in order:
+std::vector<std::string> heredocs;
+
+// a child process reaped by the SIGCHLD handler, waiting to be recorded in the job table:
+struct Reaped {
+  pid_t pid;
+  int status;
+  struct rusage usage;
+  struct timespec when;
+};
+
+// finished children are collected here by the handler and drained by update_jobs():
+#define REAPED_MAX 256
+Reaped reaped[REAPED_MAX];
+volatile sig_atomic_t reaped_count = 0;
+
+// one process of a job (a stage of its pipeline):
+struct Process {
+  pid_t pid;
+  std::string cmd;
+  bool done = false;
+  int status = 0; // wait status, once done
+  struct rusage usage = {}; // resource usage, once done
+  struct timespec start = {}, end = {}; // when it was started and reaped
+};
+
+// a pipeline started by the shell:
+struct Job {
+  std::string cmd;
+  std::vector<Process> procs;
+  int remaining = 0; // processes that haven't finished yet
+  bool background = false;
+  int shell_status = -1; // status of a last stage that ran in the shell itself, if any
+  int pipes = 0; // number of pipes between the stages
+  long pipe_bytes = 0; // their capacity as reported by the kernel
+  std::string limits; // the settings given to 'limit', if any
+  std::string cgroup; // the job's own cgroup, while it exists
+  long cgroup_cpu_usec = -1, cgroup_mem = -1; // its totals, once every process is done
+  bool cgroup_done = false;
+};
+
+// the resource limits of a job started with 'limit'. settings for cgroup files apply to
+// the job as a whole, rlimits to each of its processes:
+struct Limits {
+  std::vector<std::pair<int, rlim_t>> rlimits; // resource -> soft limit
+  std::vector<std::pair<std::string, std::string>> cgroup; // file -> value
+  long mem = -1; // the memory limit, in case the cgroup can't enforce it
+  int cgroup_fd = -1; // cgroup.procs of the job's cgroup, which every process joins
+  std::string text;
+};
+
+// where a stage's process runs, set in it before it execs: the CPUs it may use (none for
+// any), and the NUMA nodes its memory comes from (a bit per node, 0 for the default):
+struct Placement {
+  cpu_set_t cpus;
+  unsigned long nodes = 0;
+  int policy = MPOL_BIND;
+  Placement() { CPU_ZERO(&cpus); }
+};
+
+// what 'pin' asked for: the same placement for every stage, or one for each from the
+// cache topology:
+struct Pin {
+  Placement placement;
+  bool automatic = false;
+};
+
+// CPUs we may use that share a last-level cache, and the NUMA node they're on (-1 if the
+// machine has only one):
+struct CacheGroup {
+  std::vector<int> cpus;
+  int node = -1;
+};
+
+// the rc snapshot starts with this, followed by the variables the rc file read ('1' or
+// '0' for whether it was set, the name and the value, each NUL-terminated) and then its
+// commands (the argument count, and the NUL-terminated arguments):
+struct RcSnapshotHeader {
+  char magic[4]; // "MSRC"
+  uint32_t version;
+  uint64_t rc_ino, rc_size; // the rc file it was made from
+  int64_t rc_mtime_sec, rc_mtime_nsec;
+  uint32_t refs, ops; // how many variables and commands follow
+};
+
+// what running the rc file came down to, while it runs:
+struct RcRecording {
+  std::string refs, ops; // laid out like in the snapshot
+  uint32_t ref_count = 0, op_count = 0;
+  std::unordered_set<std::string> seen; // variables it has read or set
+  bool cacheable = true; // false once it runs anything but settings
+};
+
+RcRecording* rc_recording = NULL; // set while the rc file runs
+
+// how long starting up took ('myShell --startup-stats'):
+struct StartupStats {
+  bool enabled = false;
+  struct timespec start = {};
+  double environment_ms = 0, rc_ms = 0, history_ms = 0;
+  const char* rc = "none"; // how the rc file was loaded
+  int rc_commands = 0;
+} startup;
+
+// the pipes connecting the stages of a pipeline. all of them are created up front with
+// O_CLOEXEC, so a process only ever gets the two ends it's handed as its STDIN/STDOUT:
+struct Pipeline {
+  size_t count = 0; // of stages
+  std::vector<int> fds; // pipe i is fds[2*i] (read end) and fds[2*i+1] (write end)
+  long pipe_bytes = 0; // effective capacity of the pipes, after applying pipe_size
+};
+
+// a node of the alias trie, which is shared by alias lookup and tab completion. the
+// edges to its children are kept sorted by their character:
+struct AliasNode {
+  char edge = 0; // the character leading here
+  std::vector<std::pair<char, int>> next; // character -> index of the child
+  bool is_alias = false;
+  std::string value;
+};
+
+std::vector<AliasNode> alias_trie; // node 0 is the root ('')
+size_t alias_count = 0; // names defined in it
+
+// an idle helper process of the zygote pool, and the socket it waits on:
+struct Zygote {
+  pid_t pid;
+  int sock;
+};
+
+std::vector<Zygote> zygotes;
+Zygote zygote_master = {-1, -1}; // the process starting them, and the socket to it
+long zygote_size = 0; // helpers kept ready ('set zygote N'), 0 to spawn every command
+
+// what the shell sends a zygote, followed by the path, arguments and environment (the
+// descriptors travel as SCM_RIGHTS):
+struct ZygoteRequest {
+  int argc, envc;
+  int nfds; // descriptors sent along
+  int targets[ZYGOTE_FDS]; // where each of them goes
+  int background;
+};
+
+// how commands were started (see 'zygote --stats'):
+struct LaunchStats {
+  long zygote = 0, zygote_misses = 0, spawned = 0;
+  // total times: a helper's until it has the command (the shell doesn't wait for its
+  // exec), posix_spawn()'s until the exec is done. so the two aren't comparable:
+  double zygote_us = 0, spawn_us = 0;
+} launch_stats;
+
+std::map<int, Job> jobs; // job id -> job, ordered for listing
+std::unordered_map<pid_t, std::pair<int, int>> job_pids; // pid -> (job id, index into procs)
+
 /* ---------- FUNCTION DECLARATIONS ---------- */
-void run_cmd(const std::string& cmd, bool is_background);
-std::vector<std::string> splitByPipe(const std::string& input);
-std::vector<std::string> tokenize(const std::string& input);
-void handle_cd(const std::string dir);
-void handle_pwd();
+void open_reader(LineReader& reader, int fd);
+bool open_script(LineReader& reader, const char* path);
+void open_string(LineReader& reader, const char* str);
+bool read_line(LineReader& reader, std::string& line);
+bool next_line(LineReader& reader, const char* prompt, std::string& line);
+void read_heredocs(LineReader& reader, const Plan& plan);
+int open_here(const Redirect& redirect);
+bool history_open();
+bool history_sync();
+void history_index();
+void history_add(std::string_view line);
+std::string_view history_entry(size_t i);
+long history_search(std::string_view needle, size_t before, bool prefix);
+bool edit_line(const char* prompt, std::string& line);
+int read_key();
+size_t char_len(const std::string& line, size_t i);
+size_t prev_char(const std::string& line, size_t i);
+void write_str(const std::string& text);
+void out_printf(const char* format, ...);
+void redraw_line(const char* prompt, const std::string& line, size_t cursor);
+bool reverse_search(std::string& line, size_t& cursor);
+void complete_word(std::string& line, size_t& cursor, bool list);
+void command_choices(const std::string& prefix, std::vector<std::string>& choices);
+void path_choices(const std::string& word, std::vector<std::string>& choices);
+void expand_globs(Launch& launch);
+void glob(const char* pattern, std::vector<std::string>& out);
+void glob_dir(const std::string& prefix, const std::vector<GlobPattern>& components, size_t k,
+              bool dir_only, std::vector<std::string>& out);
+void compile_glob(std::string_view text, GlobPattern& pattern);
+bool match_glob(const GlobPattern& pattern, std::string_view name);
+const DirListing& list_dir(const std::string& dir);
+int run_plan(const Plan& plan);
+int run_steps(const Plan& plan, int pc);
+int run_item(const Plan& plan, int pc, bool background);
+int run_pipeline(const Plan& plan, const PipelinePlan& pipeline, bool background, Job* finished = NULL,
+                 Limits* limits = NULL, const struct Pin* pin = NULL);
+int run_async(const Plan& plan, int pc);
+pid_t fork_subshell(const Plan& plan, int body, const std::vector<std::pair<int, int>>& moves,
+                    const std::vector<int>& inherited, bool is_background, const Limits* limits = NULL,
+                    const struct Placement* placement = NULL);
+void load_rc();
+int run_rc_line(const Plan& plan, RcRecording& recording);
+int run_rc_command(const CommandPlan& command, RcRecording& recording);
+int apply_rc_op(int argc, char** argv);
+void note_rc_ref(std::string_view name, const char* value);
+bool replay_snapshot(const std::string& path, const struct stat& rc);
+void write_snapshot(const std::string& path, const struct stat& rc, const RcRecording& recording);
+double ms_since(struct timespec& since);
+void print_startup_stats();
+int start_pipeline(const Plan& plan, const PipelinePlan& piped, bool in_shell, bool background,
+                   int& status, Limits* limits = NULL, const struct Pin* pin = NULL);
+int run_par(const Plan& plan, int pc);
+int run_for(const Plan& plan, int pc);
+int run_while(const Plan& plan, int pc);
+int run_repeat(const Plan& plan, int pc);
+int run_remote(const Plan& plan, int pc);
+int run_pinned(const Plan& plan, int pc, bool background);
+bool parse_id_list(std::string_view text, std::vector<int>& ids);
+bool read_id_list(const std::string& path, std::vector<int>& ids);
+bool parse_cpu_set(std::string_view text, cpu_set_t& cpus);
+bool parse_node_mask(std::string_view text, unsigned long& nodes);
+bool place_stages(const PipelinePlan& piped, const struct Pin* pin, std::vector<struct Placement>& placements);
+const std::vector<struct CacheGroup>& cache_groups();
+void apply_placement(const struct Placement& placement);
+long arg_room();
+size_t fixed_args(char* const* argv);
+int run_batches(char* const* argv, size_t fixed, long parallel, long max_args);
+pid_t fork_batches(const Launch& launch, const std::vector<std::pair<int, int>>& moves, bool is_background);
+bool set_autobatch(const char* arg);
+int handle_batch(int argc, char** argv);
+struct timespec trace_now();
+void trace_event(const char* name, const struct timespec& start, const struct timespec* end, pid_t pid,
+                 long arg, std::string_view text);
+void trace_exec(int exec_pipe[2], pid_t pid, const char* cmd);
+void collect_execs();
+void write_trace(FILE* out, bool perf);
+void write_trace_at_exit();
+bool set_trace(const char* arg);
+int handle_trace(int argc, char** argv);
+bool start_remote(struct RemoteRun& run, const char* ssh, const std::string& control, const std::string& command);
+void remote_output(struct RemoteRun& run, size_t width, bool eof);
+int start_member(const Plan& plan, int start, const std::string& text, int& status);
+int run_timed(const Plan& plan, int pc);
+int run_memo(const Plan& plan, int pc);
+int run_limited(const Plan& plan, int pc, bool background);
+bool add_limit(Limits& limits, const std::string& key, const std::string& value);
+bool bad_limit(const std::string& key, const std::string& value);
+const std::string& cgroup_base();
+void setup_job_limits(int job_id, Limits& limits);
+void apply_limits(const Limits& limits);
+void read_cgroup_usage(const std::string& cgroup, long& cpu_usec, long& mem);
+void finish_job_cgroup(Job& job);
+void print_job_limits(const Job& job);
+bool write_file(const std::string& path, const std::string& text);
+uint64_t memo_key(const PipelinePlan& pipeline, const std::vector<std::string>& inputs,
+                  const std::vector<std::string>& vars);
+uint64_t fnv1a(const void* data, size_t len, uint64_t hash);
+std::string memo_dir();
+std::string cache_dir(const char* name);
+void memo_evict(const std::string& dir);
+int memo_stats_report();
+void prepare_launch(const CommandPlan& command, Launch& launch);
+char** command_env(const Launch& launch);
+void export_assigns(const Launch& launch);
+void expand_args(const std::vector<Word>& words, Launch& launch);
+void prepare_words(const std::vector<Word>& words, const std::vector<RedirectPlan>& redirects,
+                   bool globs, Launch& launch);
+bool resolve_fds(const Launch& launch, int in_fd, int out_fd, std::vector<std::pair<int, int>>& moves,
+                 std::vector<int>& opened);
+bool open_pipes(Pipeline& pipeline);
+int stage_input(const Pipeline& pipeline, size_t i);
+int stage_output(const Pipeline& pipeline, size_t i);
+void release_stage(Pipeline& pipeline, size_t i);
+void close_pipes(Pipeline& pipeline);
+pid_t launch_stage(const Plan& plan, const CommandPlan& stage, const Launch& launch, const Pipeline& pipeline,
+                   size_t i, bool is_background);
+pid_t spawn_stage(const Launch& launch, const std::vector<std::pair<int, int>>& moves, bool is_background);
+pid_t fork_stage(const char* path, const Launch& launch, const std::vector<std::pair<int, int>>& moves,
+                 bool is_background);
+std::shared_ptr<const Plan> compile_line(std::string_view line);
+void parse_plan(std::string_view line, Plan& plan);
+void lex(std::string_view input, int chain, std::vector<Token>& tokens);
+Word make_word(std::string_view text);
+bool next_is(const Parser& p, TokenType type);
+bool is_word(const Token& token, std::string_view word);
+bool command_ends(const Parser& p);
+void syntax_error(Parser& p);
+void parse_error(Parser& p, const std::string& message);
+std::string token_text(const Parser& p, size_t from, size_t to);
+void parse_list(Parser& p);
+bool list_ends(const Parser& p);
+void make_async(Parser& p, size_t at, size_t first_pipeline, size_t first);
+void parse_and_or(Parser& p);
+void parse_item(Parser& p);
+void parse_loop(Parser& p);
+void parse_for(Parser& p, size_t at);
+void parse_while(Parser& p, size_t at);
+void parse_body(Parser& p);
+void parse_group(Parser& p, size_t at);
+void parse_pipeline(Parser& p, bool single = false);
+void parse_command(Parser& p, CommandPlan& command);
+void parse_redirect(Parser& p, CommandPlan& command);
+void expand_alias(Parser& p);
+int run_builtin(const Launch& launch);
+bool is_builtin(const Launch& launch);
+bool is_copy_stage(const Launch& launch);
+int run_copy(const Launch& launch, int out_fd);
+int copy_fd(int in_fd, int out_fd);
+void copyInterruptHandler(int signal);
+const char* resolve_cmd(const char* name);
+void zygote_start();
+void zygote_stop();
+void zygote_collect();
+int zygote_run_master(int sock, int size);
+pid_t zygote_launch(const char* path, const Launch& launch, const std::vector<std::pair<int, int>>& moves,
+                    bool is_background);
+void zygote_main(int sock);
+bool set_zygote(const char* arg);
+bool set_fanout(const char* arg);
+int handle_zygote(int argc, char** argv);
+int alias_node(std::string_view name, bool create);
+const std::string* alias_find(std::string_view name);
+void alias_set(std::string_view name, std::string_view value);
+bool alias_unset(std::string_view name);
+void alias_choices(const std::string& prefix, std::vector<std::string>& choices);
+bool valid_alias_name(std::string_view name);
+int handle_alias(int argc, char** argv);
+int handle_unalias(int argc, char** argv);
+void init_variables();
+const char* get_var(std::string_view name);
+void set_var(std::string_view name, std::string_view value, bool exported);
+void unset_var(std::string_view name);
+bool valid_name(std::string_view name);
+bool is_assignment(std::string_view word);
+int assign_vars(int argc, char** argv);
+size_t var_ref(std::string_view input, size_t i, std::string_view& value);
+void sigchld_handler(int signal);
+void reap_children();
+void update_jobs();
+int add_job(std::string_view cmd, bool is_background);
+void add_process(int job_id, pid_t pid, std::string_view cmd, const struct timespec* start = NULL);
+int wait_job(int job_id, Job* finished = NULL);
+int wait_any(std::vector<int>& job_ids, int& status);
+int exit_code(int status);
+void stats_record(const Process& proc);
+int hist_bucket(uint64_t us);
+uint64_t hist_upper(int bucket);
+uint64_t hist_percentile(const struct CommandStats& stats, double q);
+void write_stats(FILE* out);
+void stats_dump(bool force);
+void stats_dump_at_exit();
+bool set_statsinterval(const char* arg);
+int handle_stats(int argc, char** argv);
+void notify_jobs();
+
+int handle_cd(int argc, char** argv);
+int handle_pwd(int argc, char** argv);
+int handle_color(int argc, char** argv);
+int handle_clear(int argc, char** argv);
+int handle_exit(int argc, char** argv);
+int handle_hash(int argc, char** argv);
+int handle_set(int argc, char** argv);
+int handle_history(int argc, char** argv);
+int handle_export(int argc, char** argv);
+int handle_unset(int argc, char** argv);
+int handle_jobs(int argc, char** argv);
+int handle_wait(int argc, char** argv);
+
+bool parse_size(const char* arg, long& size);
+bool set_pipesize(const char* arg);
+bool set_memosize(const char* arg);
+void print_size(long size);
+long pipe_max_size();
 
-void handle_color(std::string color);
 void clear_screen();
 void exitSignalHandler(int signal);
 void print_error(const int err_code);
 /* ---------- END FUNCTION DECLARATIONS ---------- */
 
-int main() {
+// an option changed by 'set name value':
+struct ShellOption {
+  bool (*set)(const char* arg); // applies the new value, false if it isn't valid
+  long* value;
+};
+
+const std::map<std::string, ShellOption> OPTIONS = {
+  {"autobatch", {set_autobatch, &autobatch}},
+  {"fanout", {set_fanout, &fanout}},
+  {"memosize", {set_memosize, &memo_size}},
+  {"pipesize", {set_pipesize, &pipe_size}},
+  {"statsinterval", {set_statsinterval, &stats_interval}},
+  {"trace", {set_trace, &tracing}},
+  {"zygote", {set_zygote, &zygote_size}}
+};
+
+// commands run by the shell itself, looked up for every pipeline stage:
+typedef int (*builtin_fn)(int argc, char** argv);
+const std::unordered_map<std::string, builtin_fn> BUILTINS = {
+  {"alias", handle_alias},
+  {"batch", handle_batch},
+  {"cd", handle_cd},
+  {"pwd", handle_pwd},
+  {"color", handle_color},
+  {"clear", handle_clear},
+  {"cls", handle_clear},
+  {"exit", handle_exit},
+  {"export", handle_export},
+  {"hash", handle_hash},
+  {"history", handle_history},
+  {"set", handle_set},
+  {"jobs", handle_jobs},
+  {"unalias", handle_unalias},
+  {"stats", handle_stats},
+  {"trace", handle_trace},
+  {"unset", handle_unset},
+  {"wait", handle_wait},
+  {"zygote", handle_zygote}
+};
+
+// builtins that only change settings, which the rc snapshot can replay:
+const std::unordered_set<std::string> RC_BUILTINS = {"alias", "color", "export", "set", "unalias", "unset"};
+
+// the benchmarks (bench/bench.cpp) include this file and bring their own main():
+#ifndef MYSHELL_NO_MAIN
+int main(int argc, char** argv) {
+  // started by 'set zygote N' to keep helpers ready:
+  if (argc == 4 && !strcmp(argv[1], "--zygote")) return zygote_run_master(atoi(argv[2]), atoi(argv[3]));
+  clock_gettime(CLOCK_MONOTONIC, &startup.start);
+  if (argc > 1 && !strcmp(argv[1], "--startup-stats")) {
+    startup.enabled = true;
+    argv++;
+    argc--;
+  }
+
   // set custom signal handler for SIGINT:
   signal(SIGINT, exitSignalHandler);
+  shell_pid = getpid();
 
-  // store a duplicate of STDIN:
-  const int ORIG_STDIN = dup(STDIN_FILENO);
+  // $MYSHELL_TRACE=file traces this whole session, and writes it to the file at the end:
+  if (getenv("MYSHELL_TRACE") && *getenv("MYSHELL_TRACE")) {
+    tracing = 1;
+    trace_file = getenv("MYSHELL_TRACE");
+    atexit(write_trace_at_exit);
+  }
 
-  // store the status of background processes (unused but required for waitpid()):
-  siginfo_t status;
+  // $MYSHELL_STATS=file gets the command stats every 'set statsinterval' seconds (for a
+  // metrics scraper), and when we exit:
+  if (getenv("MYSHELL_STATS") && *getenv("MYSHELL_STATS")) atexit(stats_dump_at_exit);
 
-  // continuously take user input:
-  std::string input;
-  bool is_background;
-  while (1) {
-    // have any child processes finished? if so, kill them:
-    waitid(P_PID, 0, &status, WNOHANG);
+  // the environment we were started with becomes our exported variables:
+  struct timespec phase = startup.start;
+  init_variables();
+  startup.environment_ms = ms_since(phase);
 
-    // replace STDIN with ORIG_STDIN in case we changed it in a previous command:
-    dup2(ORIG_STDIN, STDIN_FILENO);
+  // reap finished children as soon as they exit (restarting interrupted reads):
+  struct sigaction chld_action = {};
+  chld_action.sa_handler = sigchld_handler;
+  chld_action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &chld_action, NULL);
 
-    printf("shell >> ");
+  // 'myShell -c "cmd"' runs the given commands, 'myShell script.sh' runs a script,
+  // and otherwise we read from STDIN (prompting only if it's a terminal):
+  LineReader reader;
+  if (argc == 2 && !strcmp(argv[1], "-c")) {
+    fprintf(stderr, "[myShell] error: usage: myShell [-c commands | script]\n");
+    return 2;
+  }
+  if (argc > 2 && !strcmp(argv[1], "-c")) open_string(reader, argv[2]);
+  else if (argc > 1) {
+    if (!open_script(reader, argv[1])) {
+      print_error(4);
+      return 127;
+    }
+  }
+  else {
+    open_reader(reader, STDIN_FILENO);
+    interactive = isatty(STDIN_FILENO);
+  }
 
-    // get user input:
-    getline(std::cin, input);
+  // what the shell prints is flushed whenever something else is about to write (a command,
+  // or the prompt), so a terminal doesn't need to cost a write() per line:
+  setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
 
-    // if user wants to exit, exit the program:
-    if (input == "exit") return 0;
+  // a terminal session is set up by ~/.myshellrc first (which may set $HISTFILE):
+  if (interactive) {
+    ms_since(phase);
+    load_rc();
+    startup.rc_ms = ms_since(phase);
+    history_open(); // only maps the file, it's indexed when first searched
+    startup.history_ms = ms_since(phase);
+  }
 
-    // if user wants to clear the screen:
-    else if (input == "clear" || input == "cls") {
-      clear_screen();
-      continue;
+  // continuously take user input:
+  std::string input;
+  while (1) {
+    // have any background jobs finished? if so, tell the user:
+    notify_jobs();
+    stats_dump(false);
+    if (startup.enabled) {
+      print_startup_stats();
+      startup.enabled = false;
     }
 
-    // if user wants to change directory:
-    else if (input == "cd") { // if no argument provided
-      handle_cd("");
+    // get user input (with the line editor on a terminal), quitting at the end of it. the
+    // prompt is drawn in the color that was chosen, along with the job notices above:
+    struct timespec read_start;
+    if (tracing) read_start = trace_now();
+    if (!next_line(reader, (text_color + "shell >> ").c_str(), input)) {
+      if (interactive) printf("\n");
+      return last_status;
     }
-    else if (!input.rfind("cd ", 0)) {
-      handle_cd(input.substr(3));
-      continue;
+    if (tracing) {
+      struct timespec now = trace_now();
+      trace_event("read", read_start, &now, 0, input.size(), input);
     }
 
-    // if user wants to print the current working directory:
-    // NOTE: we ignore anything that comes after 'pwd' as the Unix shell does
-    else if (input == "pwd" || !input.rfind("pwd ", 0)) {
-      handle_pwd();
-      continue;
-    }
+    // compile the line (unless it ran before), and run it:
+    if (interactive) history_add(input);
+    std::shared_ptr<const Plan> plan = compile_line(input);
+    read_heredocs(reader, *plan);
+    last_status = run_plan(*plan);
+  }
+}
+#endif
+
+// runs a compiled line, or says why it couldn't be compiled:
+int run_plan(const Plan& plan) {
+  if (!plan.error.empty()) {
+    fprintf(stderr, "%s\n", plan.error.c_str());
+    return 2;
+  }
+  return run_steps(plan, 0);
+}
 
-    // if user wants to change the shell's text color:
-    else if (!input.rfind("color", 0)) {
-      handle_color(input.substr(6));
+// runs the list starting at step pc and returns the status of the last command it ran.
+// '&&' and '||' skip ahead to the end of what they guard:
+int run_steps(const Plan& plan, int pc) {
+  int status = 0;
+  while (plan.steps[pc].op != STEP_END) {
+    const Step& step = plan.steps[pc];
+    if (step.op == STEP_AND || step.op == STEP_OR) {
+      pc = (status == 0) == (step.op == STEP_AND) ? step.next : step.arg;
       continue;
     }
+    status = last_status = run_item(plan, pc, false);
+    pc = step.next;
+  }
+  return status;
+}
 
-    // parse the given input by pipes:
-    std::vector<std::string> piped = splitByPipe(input);
+// runs the command at step pc: a pipeline, possibly under 'time', 'memo', 'limit' or 'par',
+// or a loop:
+int run_item(const Plan& plan, int pc, bool background) {
+  const Step& step = plan.steps[pc];
+  switch (step.op) {
+    case STEP_PIPELINE: return run_pipeline(plan, plan.pipelines[step.arg], background);
+    case STEP_ASYNC: return run_async(plan, pc);
+    case STEP_TIME: return run_timed(plan, pc);
+    case STEP_MEMO: return run_memo(plan, pc);
+    case STEP_LIMIT: return run_limited(plan, pc, background);
+    case STEP_PAR: return run_par(plan, pc);
+    case STEP_FOR: return run_for(plan, pc);
+    case STEP_WHILE: case STEP_UNTIL: return run_while(plan, pc);
+    case STEP_REPEAT: return run_repeat(plan, pc);
+    case STEP_REMOTE: return run_remote(plan, pc);
+    case STEP_PIN: return run_pinned(plan, pc, background);
+    default: return 0;
+  }
+}
 
-    // is this a background process?
-    is_background = (piped.back() == "&");
-    piped.pop_back(); // remove the "background flag" from command list
+// runs a pipeline, and waits for it unless it's in the background. a command of nothing
+// but 'NAME=value' sets variables in the shell instead:
+int run_pipeline(const Plan& plan, const PipelinePlan& pipeline, bool background, Job* finished,
+                 Limits* limits, const Pin* pin) {
+  const CommandPlan& first = pipeline.stages[0];
+  bool alone = pipeline.stages.size() == 1 && !background && !limits && !pin;
+  if (alone && first.assignments) {
+    Launch launch;
+    prepare_launch(first, launch);
+    return assign_vars(launch.argv.size() - 1, launch.argv.data());
+  }
 
-    // pipe loop structure, piping each process's STDOUT to the next process's STDIN:
-    pid_t childpid; // to keep track of child's pid
-    int fd[2]; // for pipe file descriptors
-    for (int i = 0; i < piped.size() - 1; i++) {
-      pipe(fd);
+  // a loop on its own runs in the shell itself (so what its body sets stays set). piped
+  // or redirected, it's a subshell like '( list )':
+  if (alone && first.loop && first.redirects.empty()) return run_steps(plan, first.subshell);
+  int status = 0;
+  int job_id = start_pipeline(plan, pipeline, true, background, status, limits, pin);
+  if (job_id) status = wait_job(job_id, finished);
+  return status;
+}
 
-      // start the child process:
-      childpid = fork();
+// runs the body of a '&': a pipeline (or a limited or pinned one) becomes a background job of its
+// own, and anything else runs in a subshell that is the job:
+int run_async(const Plan& plan, int pc) {
+  const Step& step = plan.steps[pc];
+  const Step& body = plan.steps[pc + 1];
+  bool single = body.next + 1 == step.next;
+  if (single && (body.op == STEP_PIPELINE || body.op == STEP_LIMIT || body.op == STEP_PIN)) {
+    return run_item(plan, pc + 1, true);
+  }
 
-      // make sure the child process has been successfully created:
-      if (childpid < 0) {
-        print_error(0);
-        break;
-      }
-      // if we're in the child process:
-      else if (!childpid) {
-        dup2(fd[1], STDOUT_FILENO); // redirect child's output through pipe
-        run_cmd(piped[i], is_background);
-      }
-      // if we're in the parent process:
-      else {
-        // wait for the child process to finish:
-        dup2(fd[0], STDIN_FILENO); // redirect parent's input through pipe
-        close(fd[1]);
-      }
-    }
+  pid_t pid = fork_subshell(plan, pc + 1, {}, {}, true);
+  if (pid < 0) return 1;
+  int job_id = add_job(step.texts[0] + " &", true);
+  add_process(job_id, pid, step.texts[0]);
+  if (interactive) printf("[%d] %d\n", job_id, pid);
+  return 0;
+}
 
-    // still one more command to take care of!
-    dup2(fd[0], STDIN_FILENO);
+// starts a copy of the shell that runs the list at step body (for '( list )' and '&'),
+// with the given (target, source) descriptor moves done first. the other descriptors in
+// inherited (the pipes of the pipeline it's part of) are closed in the copy, since it
+// doesn't exec and so would keep them open:
+pid_t fork_subshell(const Plan& plan, int body, const std::vector<std::pair<int, int>>& moves,
+                    const std::vector<int>& inherited, bool is_background, const Limits* limits,
+                    const Placement* placement) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) print_error(0);
+  if (pid) return pid;
 
-    // create the last process and execute the last command:
-    childpid = fork();
-    if (childpid < 0) print_error(0);
-    if (!childpid) run_cmd(piped.back(), is_background);
-    else if (!is_background) wait(NULL);
-    close(fd[1]); // important to close this so system doesn't wait on pipe to close!
+  if (is_background) setpgid(0, 0);
+  for (const auto& move : moves) dup2(move.second, move.first);
+  for (int fd : inherited) {
+    bool target = false;
+    for (const auto& move : moves) target |= move.first == fd;
+    if (fd >= 0 && !target) close(fd);
   }
+  if (limits) apply_limits(*limits);
+  if (placement) apply_placement(*placement);
 
-  return 0;
+  // the jobs and the zygote pool belong to the shell itself:
+  interactive = false;
+  jobs.clear();
+  job_pids.clear();
+  zygote_stop();
+  zygote_size = 0;
+  int status = run_steps(plan, body);
+  fflush(stdout);
+  _exit(status);
 }
 
-void run_cmd(const std::string& cmd, bool is_background) {
-  // if this is a background process:
-  if (is_background) setpgid(0, 0);
+// starts the stages of a pipeline and returns the id of its job if we need to wait for it
+// (0 for background jobs, or if nothing was started). stages may only run in the shell
+// itself if in_shell is set, and the status of such a stage is stored in status. with
+// limits, every stage is a new process that gets them before it execs:
+int start_pipeline(const Plan& plan, const PipelinePlan& piped, bool in_shell, bool background,
+                   int& status, Limits* limits, const Pin* pin) {
+  Pipeline pipeline;
+  pipeline.count = piped.stages.size();
+  if (!pipeline.count) return 0;
+  in_shell = in_shell && !background && !limits;
+  fflush(stdout); // what we've printed so far comes before the stages' output
+
+  // where each stage runs, if any of them is pinned (which keeps it out of the shell itself):
+  std::vector<Placement> placements;
+  if (!place_stages(piped, pin, placements)) {
+    status = 1;
+    return 0;
+  }
+  auto placement_of = [&](size_t i) -> const Placement* {
+    if (placements.empty() || (!CPU_COUNT(&placements[i].cpus) && !placements[i].nodes)) return NULL;
+    return &placements[i];
+  };
 
-  // tokenize command:
-  std::vector<std::string> tokenized = tokenize(cmd);
+  // the last stage is prepared first, since it may run in the shell itself
+  // (a builtin, or a stage that only copies data):
+  const CommandPlan& last_stage = piped.stages.back();
+  Launch last;
+  prepare_launch(last_stage, last);
+  bool last_in_shell = in_shell && last_stage.subshell < 0 && !placement_of(pipeline.count - 1) &&
+                       (is_builtin(last) || is_copy_stage(last));
 
-  int FFLAGS = FILEFLAGS; // FILEFLAGS if no append, FILEFLAGS | O_APPEND if user wants to append
-  int ARGC = tokenized.size() + 1; // length of argument array. will be reduced by 2 if there's redirection
+  // otherwise, a first stage that only copies data (e.g. 'cat file | ...') can be done
+  // by the shell once the rest of the pipeline is running:
+  Launch first;
+  bool copy_first = false;
+  if (pipeline.count > 1 && in_shell && !last_in_shell && piped.stages[0].subshell < 0 && !placement_of(0)) {
+    prepare_launch(piped.stages[0], first);
+    copy_first = is_copy_stage(first) && (first.redirects.empty() || first.redirects[0].fd != STDOUT_FILENO);
+  }
 
-  // naive implementation: only check if second-to-last token is '>'. if so, redirect output:
-  if (tokenized.size() > 1) {
-    // if user wants to append instead of overwrite file:
-    if (tokenized[tokenized.size()-2] == ">>") FFLAGS = FILEFLAGS_APPEND;
-    // if we have output redirection:
-    if (tokenized[tokenized.size()-2][0] == '>') {
-      // open the output fd, redirect the output, and execute the command:
-      close(STDOUT_FILENO);
-      int fd = open(tokenized.back().c_str(), FFLAGS, RW_PERMS);
-      dup2(fd, STDOUT_FILENO); // redirect fd to stdout (STDOUT_FILENO = 1)
-      ARGC -= 2; // reduce arg length by 2 (since last 2 args are '>' and the filename)
-    }
-    // if we have input redirection:
-    if (tokenized[tokenized.size() - 2] == "<") {
-      // open the output fd, redirect the output, and execute the command:
-      close(STDIN_FILENO);
-      int fd = open(tokenized.back().c_str(), O_RDONLY); // no need to have write permissions
-      dup2(fd, STDIN_FILENO); // redirect fd to stdout (STDOUT_FILENO = 1)
-      ARGC -= 2; // reduce arg length by 2 (since last 2 args are '>' and the filename)
+  status = 0;
+  if (!open_pipes(pipeline)) {
+    print_error(0);
+    status = 1;
+    return 0;
+  }
+
+  // start every stage with its end of the pipes around it, closing our copies right away
+  // so only the stages hold them (the shell's own first or last stage keeps its ends):
+  Launch launch; // the current stage, prepared in the parent
+  int job_id = add_job(background ? piped.text + " &" : piped.text, background); // every stage is recorded in the job table
+  jobs[job_id].pipes = pipeline.count - 1;
+  jobs[job_id].pipe_bytes = pipeline.pipe_bytes;
+  if (limits) setup_job_limits(job_id, *limits);
+  pid_t childpid = -1; // to keep track of child's pid
+  for (size_t i = 0; i < pipeline.count - 1; i++) {
+    if (i == 0 && copy_first) continue;
+    prepare_launch(piped.stages[i], launch);
+    launch.limits = limits;
+    launch.placement = placement_of(i);
+    struct timespec spawn_start; // where the process's time starts (before it's spawned)
+    clock_gettime(CLOCK_MONOTONIC, &spawn_start);
+    childpid = launch_stage(plan, piped.stages[i], launch, pipeline, i, background);
+    if (tracing) {
+      struct timespec now = trace_now();
+      trace_event("spawn", spawn_start, &now, childpid > 0 ? childpid : 0, i, piped.stages[i].text);
     }
+    if (childpid > 0) add_process(job_id, childpid, piped.stages[i].text, &spawn_start);
+    release_stage(pipeline, i);
   }
 
-  // construct arg list:
-  char* args[ARGC];
-  args[ARGC-1] = NULL;
-  for (int i = 0; i < ARGC-1; i++) {
-    args[i] = (char*) tokenized[i].c_str();
+  // create the last process and execute the last command:
+  size_t last_i = pipeline.count - 1;
+  if (last_in_shell) {
+    status = is_builtin(last) ? run_builtin(last) : run_copy(last, STDOUT_FILENO);
+    childpid = -1;
+  }
+  else {
+    last.limits = limits;
+    last.placement = placement_of(last_i);
+    struct timespec spawn_start; // where the process's time starts (before it's spawned)
+    clock_gettime(CLOCK_MONOTONIC, &spawn_start);
+    childpid = launch_stage(plan, last_stage, last, pipeline, last_i, background);
+    if (tracing) {
+      struct timespec now = trace_now();
+      trace_event("spawn", spawn_start, &now, childpid > 0 ? childpid : 0, last_i, last_stage.text);
+    }
+    // like other shells, for commands that couldn't run (or be redirected):
+    if (childpid < 0) status = childpid == REDIRECT_FAILED ? 1 : 127;
+    else add_process(job_id, childpid, last_stage.text, &spawn_start);
   }
+  release_stage(pipeline, last_i);
 
-  // execute the command:
-  execvp(args[0], args);
+  // now that everything reading from it is running, do the first stage's copy (the
+  // read end is only held by the next stage, so we notice when the reader goes away):
+  if (copy_first) run_copy(first, stage_output(pipeline, 0));
+  close_pipes(pipeline);
+  if (limits && limits->cgroup_fd >= 0) close(limits->cgroup_fd);
 
-  // if we're still here, there has been an error in the execution and we need
-  // to kill the current process:
-  print_error(1);
-  exit(-1);
+  // background jobs are reported by notify_jobs(), otherwise every stage is waited for:
+  Job& job = jobs[job_id];
+  if (job.procs.empty()) {
+    finish_job_cgroup(job);
+    jobs.erase(job_id);
+  }
+  else if (background) {
+    if (interactive) printf("[%d] %d\n", job_id, job.procs.back().pid);
+  }
+  else {
+    if (last_in_shell || childpid < 0) job.shell_status = status;
+    return job_id;
+  }
+  return 0;
 }
 
-std::vector<std::string> splitByPipe(const std::string& input) {
-  bool background = false;
-  std::vector<std::string> output;
-  int start = 0;
-  for (int i = 0; i < input.size(); i++) {
-    // if process should be a background process:
-    if (input[i] == '&') background = true;
+/* ---------- PIPES ---------- */
 
-    /* neat trick for handling multiple commands:
-     * since extra input redirected from last command doesn't matter,
-     * we can just pretend the ';' is just another pipe and be lazy */
-    if (input[i] == '|' || input[i] == ';') {
-      output.push_back(input.substr(start, i-start));
-      start = i+1;
-      // make sure we don't start on a space character:
-      if (start < input.size() && input[start] == ' ') start++;
-    }
-    // if we see an open quote, ignore input until we find a closing quote:
-    else if (input[i] == '\"') {
-      while (i < input.size() && input[++i] != '\"');
+bool open_pipes(Pipeline& pipeline) {
+  pipeline.fds.assign(2 * (pipeline.count - 1), -1);
+  for (size_t i = 0; i + 1 < pipeline.count; i++) {
+    if (pipe2(&pipeline.fds[2*i], O_CLOEXEC) == -1) {
+      close_pipes(pipeline);
+      return false;
     }
+    // a bigger buffer lets stages running at different rates switch less often. this can
+    // still fail once the user has too many big pipes, which just leaves the default size:
+    if (pipe_size) fcntl(pipeline.fds[2*i+1], F_SETPIPE_SZ, (int) pipe_size);
+  }
+  if (!pipeline.fds.empty()) pipeline.pipe_bytes = fcntl(pipeline.fds[1], F_GETPIPE_SZ);
+  return true;
+}
+
+// the read end of the pipe before stage i (-1 for the first stage, which keeps our STDIN):
+int stage_input(const Pipeline& pipeline, size_t i) {
+  return i ? pipeline.fds[2*(i-1)] : -1;
+}
+
+// the write end of the pipe after stage i (-1 for the last stage, which keeps our STDOUT):
+int stage_output(const Pipeline& pipeline, size_t i) {
+  return i + 1 < pipeline.count ? pipeline.fds[2*i+1] : -1;
+}
+
+// closes our copies of the ends handed to stage i, once it has been started:
+void release_stage(Pipeline& pipeline, size_t i) {
+  if (i) {
+    close(pipeline.fds[2*(i-1)]);
+    pipeline.fds[2*(i-1)] = -1;
+  }
+  if (i + 1 < pipeline.count) {
+    close(pipeline.fds[2*i+1]);
+    pipeline.fds[2*i+1] = -1;
   }
+}
 
-  // get the rest of the input string, if there is any:
-  if (start < input.size()-1) {
-    output.push_back(input.substr(start));
+void close_pipes(Pipeline& pipeline) {
+  for (int& fd : pipeline.fds) {
+    if (fd >= 0) close(fd);
+    fd = -1;
   }
+}
 
-  // append "&" to end of output if background process, "-" otherwise:
-  output.push_back(background ? "&" : "-");
+/* ---------- LOOPS ---------- */
 
-  return output;
+// loop bodies were compiled along with the line, so every iteration only expands their
+// words again. a command killed by CTRL+C ends the loop, like in other shells.
+
+// 'for NAME in word...; do list; done' expands the words (and globs) once, and runs the
+// list with NAME set to each of them in turn:
+int run_for(const Plan& plan, int pc) {
+  const Step& step = plan.steps[pc];
+  Launch words;
+  prepare_words(step.args, {}, true, words);
+  int status = 0;
+  for (size_t i = 0; words.argv[i] && status != 128 + SIGINT; i++) {
+    set_var(step.name, words.argv[i], false);
+    status = run_steps(plan, pc + 1);
+  }
+  return status;
 }
 
-std::vector<std::string> tokenize(const std::string& input) {
-  // create the string vector
-  std::vector<std::string> tokens;
-  int start = 0, end = 0;
-  for (unsigned int i = 0; i < input.size(); i++) {
-    // check (and split) by spaces:
-    if (input[i] == ' ') {
-      end = i;
-      tokens.push_back(input.substr(start, end-start));
-      start = i+1;
-    }
-    // properly tokenize quotation marks:
-    else if (input[i] == '\"') {
-      start = ++i; // increment i to ignore opening quotation mark
-      while (i < input.size() && input[i] != '\"') i++; // find closing quotation mark
-      end = i;
-      tokens.push_back(input.substr(start, end-start));
-      start = ++i;
+// 'while list; do list; done' (and 'until'). its status is that of the body's last run:
+int run_while(const Plan& plan, int pc) {
+  const Step& step = plan.steps[pc];
+  int status = 0;
+  while (status != 128 + SIGINT) {
+    int test = run_steps(plan, pc + 1);
+    if (test == 128 + SIGINT || (test == 0) != (step.op == STEP_WHILE)) break;
+    status = run_steps(plan, step.arg);
+  }
+  return status;
+}
 
-      // make sure we don't start on a space character:
-      if (start < input.size() && input[start] == ' ') start++;
-    }
+// 'repeat N command' runs the command N times, and has the status of its last run:
+int run_repeat(const Plan& plan, int pc) {
+  const Step& step = plan.steps[pc];
+  Launch count;
+  expand_args(step.args, count);
+  char* end = NULL;
+  long n = count.argv[0] ? strtol(count.argv[0], &end, 10) : -1;
+  if (n < 0 || *end || step.next == pc + 1) {
+    fprintf(stderr, "[repeat] error: usage: repeat N command\n");
+    return 1;
+  }
+  int status = 0;
+  for (long i = 0; i < n && status != 128 + SIGINT; i++) status = run_item(plan, pc + 1, false);
+  return status;
+}
+
+/* ---------- TIMING ---------- */
+
+double seconds(const struct timeval& tv) {
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+double seconds_between(const struct timespec& start, const struct timespec& end) {
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+void print_time_row(const char* name, double wall, double user, double sys, long maxrss,
+                    long vcsw, long ivcsw) {
+  fprintf(stderr, "%-24.24s %9.3fs %9.3fs %9.3fs %8ldK %7ld %7ld\n", name, wall, user, sys,
+          maxrss, vcsw, ivcsw);
+}
+
+// 'time pipeline' runs the pipeline, waits for every one of its stages and prints the wall
+// and cpu time, peak memory and context switches of each of them (and of the whole):
+int run_timed(const Plan& plan, int pc) {
+  // the shell's own share covers stages it ran itself (builtins and copies):
+  struct rusage self_before, self_after, children_before, children_after;
+  struct timespec start, end;
+  getrusage(RUSAGE_SELF, &self_before);
+  getrusage(RUSAGE_CHILDREN, &children_before);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // a pipeline is timed stage by stage, anything else (e.g. 'par') as a whole:
+  const Step& body = plan.steps[pc + 1];
+  int status = 0;
+  Job finished;
+  if (plan.steps[pc].next == pc + 1) status = 0; // nothing to time
+  else if (body.op == STEP_PIPELINE) status = run_pipeline(plan, plan.pipelines[body.arg], false, &finished);
+  else status = run_item(plan, pc + 1, false);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  getrusage(RUSAGE_SELF, &self_after);
+  getrusage(RUSAGE_CHILDREN, &children_after);
+
+  fprintf(stderr, "%-24s %10s %10s %10s %9s %7s %7s\n", "stage", "wall", "user", "sys", "maxrss",
+          "vcsw", "ivcsw");
+  double user = 0, sys = 0;
+  long maxrss = 0, vcsw = 0, ivcsw = 0;
+  for (const Process& proc : finished.procs) {
+    const struct rusage& ru = proc.usage;
+    print_time_row(proc.cmd.c_str(), seconds_between(proc.start, proc.end), seconds(ru.ru_utime),
+                   seconds(ru.ru_stime), ru.ru_maxrss, ru.ru_nvcsw, ru.ru_nivcsw);
+    user += seconds(ru.ru_utime);
+    sys += seconds(ru.ru_stime);
+    maxrss = std::max(maxrss, ru.ru_maxrss);
+    vcsw += ru.ru_nvcsw;
+    ivcsw += ru.ru_nivcsw;
   }
-  // get the rest of the string, if there is any:
-  if (start < input.size()-1) {
-    tokens.push_back(input.substr(start));
+
+  // without a job of our own (e.g. for 'par') we only know about children as a whole:
+  if (finished.procs.empty()) {
+    user = seconds(children_after.ru_utime) - seconds(children_before.ru_utime);
+    sys = seconds(children_after.ru_stime) - seconds(children_before.ru_stime);
+    maxrss = children_after.ru_maxrss;
+    vcsw = children_after.ru_nvcsw - children_before.ru_nvcsw;
+    ivcsw = children_after.ru_nivcsw - children_before.ru_nivcsw;
   }
 
-  return tokens;
+  double self_user = seconds(self_after.ru_utime) - seconds(self_before.ru_utime);
+  double self_sys = seconds(self_after.ru_stime) - seconds(self_before.ru_stime);
+  print_time_row("(shell)", seconds_between(start, end), self_user, self_sys, self_after.ru_maxrss,
+                 self_after.ru_nvcsw - self_before.ru_nvcsw, self_after.ru_nivcsw - self_before.ru_nivcsw);
+  print_time_row("total", seconds_between(start, end), user + self_user, sys + self_sys,
+                 std::max(maxrss, self_after.ru_maxrss),
+                 vcsw + self_after.ru_nvcsw - self_before.ru_nvcsw,
+                 ivcsw + self_after.ru_nivcsw - self_before.ru_nivcsw);
+  if (finished.pipes) {
+    fprintf(stderr, "pipes: %d x %ldK\n", finished.pipes, finished.pipe_bytes / 1024);
+  }
+  return status;
 }
 
-void handle_cd(const std::string dir) {
-  // no arg provided, cd to home directory (as the unix shell does):
-  if (dir == "") {
-    chdir(getenv("HOME"));
+/* ---------- TRACING ---------- */
+
+// an event recorded while tracing: a span, or an instant if it has no end:
+struct TraceEvent {
+  // 'read', 'parse', 'spawn', 'exec', 'wait' or 'exit', and 'first-byte' for data the
+  // shell moves itself (copies and '@hosts' output, as the output of other stages never
+  // passes through it):
+  const char* name;
+  struct timespec start, end;
+  bool span;
+  pid_t pid; // the process it's about, 0 for the shell itself
+  long arg; // a stage's index, a job's id, an exit status...
+  char text[48]; // the command, cut short
+};
+
+// only the shell's main flow records events (never a signal handler), so the ring needs no
+// locks, and nothing is allocated per event. trace_count keeps counting past TRACE_EVENTS,
+// and the ring holds the most recent of them:
+TraceEvent trace_ring[TRACE_EVENTS];
+uint64_t trace_count = 0;
+
+struct timespec trace_now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now;
+}
+
+// callers check 'tracing' first, so tracing costs nothing but that test while it's off:
+void trace_event(const char* name, const struct timespec& start, const struct timespec* end, pid_t pid,
+                 long arg, std::string_view text) {
+  TraceEvent& event = trace_ring[trace_count++ & (TRACE_EVENTS - 1)];
+  event.name = name;
+  event.start = start;
+  event.end = end ? *end : start;
+  event.span = end != NULL;
+  event.pid = pid;
+  event.arg = arg;
+  size_t len = std::min(text.size(), sizeof(event.text) - 1);
+  memcpy(event.text, text.data(), len);
+  event.text[len] = '\0';
+}
+
+// processes started while tracing that may not have exec'd yet: the read end of each one's
+// exec pipe, whose write end is close-on-exec and held by the process:
+struct PendingExec {
+  int fd;
+  pid_t pid;
+  std::string cmd;
+};
+std::vector<PendingExec> pending_execs;
+
+// the shell never waits for the exec (which would hold it up, and skew what's traced): a
+// forked process writes the time it calls exec() into the pipe itself, and the event is
+// recorded once the pipe hangs up (see collect_execs()):
+void trace_exec(int exec_pipe[2], pid_t pid, const char* cmd) {
+  close(exec_pipe[1]);
+  if (pid <= 0) {
+    close(exec_pipe[0]);
     return;
   }
+  pending_execs.push_back({exec_pipe[0], pid, cmd});
+  collect_execs();
+}
 
-  // if arg provided, change the directory appropriately.
-  // if no such directory, print an error message:
-  if (chdir(dir.c_str()) == -1) {
-    print_error(2);
+// records 'exec' for every pending process whose pipe has hung up, without blocking. no
+// time in the pipe means posix_spawn() started it, which only returns once it has exec'd.
+// a second one means its exec failed:
+void collect_execs() {
+  for (size_t i = 0; i < pending_execs.size();) {
+    PendingExec& pending = pending_execs[i];
+    struct pollfd check = {pending.fd, POLLIN, 0};
+    if (poll(&check, 1, 0) != 1 || !(check.revents & POLLHUP)) {
+      i++;
+      continue;
+    }
+    struct timespec times[2];
+    ssize_t n = read(pending.fd, times, sizeof(times));
+    if (n == 0) trace_event("exec", trace_now(), NULL, pending.pid, 0, pending.cmd);
+    else if (n == sizeof(times[0])) trace_event("exec", times[0], NULL, pending.pid, 0, pending.cmd);
+    close(pending.fd);
+    pending = std::move(pending_execs.back());
+    pending_execs.pop_back();
   }
 }
 
-void handle_pwd() {
-  printf("%s\n", getcwd(NULL, 0));
+// writes the ring as Chrome trace JSON (for chrome://tracing or Perfetto, where every
+// process gets a row of its own), or with perf as lines in the form of 'perf script':
+void write_trace(FILE* out, bool perf) {
+  if (!pending_execs.empty()) collect_execs();
+  pid_t self = getpid();
+  uint64_t first = trace_count > TRACE_EVENTS ? trace_count - TRACE_EVENTS : 0;
+  if (!perf) fprintf(out, "{\"traceEvents\":[");
+  for (uint64_t i = first; i < trace_count; i++) {
+    const TraceEvent& event = trace_ring[i & (TRACE_EVENTS - 1)];
+    double start_us = event.start.tv_sec * 1e6 + event.start.tv_nsec / 1e3;
+    double dur_us = seconds_between(event.start, event.end) * 1e6;
+    pid_t tid = event.pid ? event.pid : self;
+    if (perf) {
+      fprintf(out, "myShell %d/%d [000] %.6f: myshell:%s: arg=%ld", self, tid, start_us / 1e6, event.name, event.arg);
+      if (event.span) fprintf(out, " dur_us=%.3f", dur_us);
+      fprintf(out, " cmd=%s\n", event.text);
+      continue;
+    }
+    fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,", i > first ? "," : "", event.name,
+            event.span ? "X" : "i", start_us);
+    if (event.span) fprintf(out, "\"dur\":%.3f,", dur_us);
+    else fprintf(out, "\"s\":\"t\",");
+    fprintf(out, "\"pid\":%d,\"tid\":%d,\"args\":{\"arg\":%ld,\"cmd\":\"", self, tid, event.arg);
+    for (const char* c = event.text; *c; c++) {
+      if (*c == '"' || *c == '\\') fprintf(out, "\\%c", *c);
+      else if ((unsigned char) *c < ' ') fprintf(out, "\\u%04x", *c);
+      else fputc(*c, out);
+    }
+    fprintf(out, "\"}}");
+  }
+  if (!perf) fprintf(out, "\n]}\n");
 }
 
-/* ---------- UTILITY FUNCTIONS ---------- */
-
-void handle_color(std::string color) {
-  if (COLORS.find(color) == COLORS.end()) {
-    printf("[color] error: no such color found.\n");
+void write_trace_at_exit() {
+  if (getpid() != shell_pid) return;
+  FILE* out = fopen(trace_file.c_str(), "w");
+  if (!out) {
+    fprintf(stderr, "[trace] error: %s: %s\n", trace_file.c_str(), strerror(errno));
     return;
   }
-  printf("%s", COLORS.at(color).c_str());
+  write_trace(out, false);
+  fclose(out);
+}
+
+bool set_trace(const char* arg) {
+  if (!strcmp(arg, "on") || !strcmp(arg, "1")) tracing = 1;
+  else if (!strcmp(arg, "off") || !strcmp(arg, "0")) tracing = 0;
+  else {
+    fprintf(stderr, "[trace] error: usage: set trace on|off\n");
+    return false;
+  }
+  return true;
+}
+
+// 'trace [-p] [file]' writes what has been traced (as Chrome JSON, or for perf with -p),
+// and 'trace -c' forgets it:
+int handle_trace(int argc, char** argv) {
+  bool perf = argc > 1 && !strcmp(argv[1], "-p");
+  if (argc > 1 && !strcmp(argv[1], "-c")) {
+    trace_count = 0;
+    return 0;
+  }
+  if (argc > 2 + perf || (argc > 1 + perf && argv[1 + perf][0] == '-')) {
+    fprintf(stderr, "[trace] error: usage: trace [-p] [file], trace -c\n");
+    return 1;
+  }
+  if (argc == 1 + perf) {
+    write_trace(stdout, perf);
+    return 0;
+  }
+  FILE* out = fopen(argv[1 + perf], "w");
+  if (!out) {
+    fprintf(stderr, "[trace] error: %s: %s\n", argv[1 + perf], strerror(errno));
+    return 1;
+  }
+  write_trace(out, perf);
+  fclose(out);
+  return 0;
+}
+
+/* ---------- MEMO CACHE ---------- */
+
+// runs 'memo [-i file]... [-e var]... cmd', or 'memo --stats'. the output and exit status
+// of cmd are stored under a hash of its arguments, the working directory, $PATH and the
+// given variables, and the size and modification time of the given input files:
+int run_memo(const Plan& plan, int pc) {
+  const Step& step = plan.steps[pc];
+  Launch options;
+  expand_args(step.args, options);
+  const char* usage = "[memo] error: usage: memo [-i file]... [-e var]... command\n";
+  std::vector<std::string> inputs, vars;
+  for (size_t i = 0; options.argv[i]; i++) {
+    if (!strcmp(options.argv[i], "--stats")) return memo_stats_report();
+    bool input = !strcmp(options.argv[i], "-i");
+    if ((!input && strcmp(options.argv[i], "-e")) || !options.argv[i+1]) {
+      fprintf(stderr, "%s", usage);
+      return 1;
+    }
+    (input ? inputs : vars).emplace_back(options.argv[++i]);
+  }
+  if (step.next == pc + 1) {
+    fprintf(stderr, "%s", usage);
+    return 1;
+  }
+
+  // (aliases were expanded when the line was parsed, so redefining one changes the key):
+  const PipelinePlan& pipeline = plan.pipelines[plan.steps[pc + 1].arg];
+  std::string dir = memo_dir();
+  if (dir.empty()) {
+    memo_stats.uncached++;
+    return run_pipeline(plan, pipeline, false);
+  }
+  char name[17];
+  snprintf(name, sizeof(name), "%016llx", (unsigned long long) memo_key(pipeline, inputs, vars));
+  std::string path = dir + "/" + name;
+
+  // let a closed STDOUT stop a replay instead of killing the shell:
+  struct sigaction ignore = {}, orig_pipe;
+  ignore.sa_handler = SIG_IGN;
+  fflush(stdout);
+
+  // a hit replays the stored output, and marks the entry as recently used for eviction:
+  MemoHeader header;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd >= 0 && read(fd, &header, sizeof(header)) == sizeof(header) && !memcmp(header.magic, "MEMO", 4)) {
+    futimens(fd, NULL);
+    sigaction(SIGPIPE, &ignore, &orig_pipe);
+    copy_fd(fd, STDOUT_FILENO);
+    sigaction(SIGPIPE, &orig_pipe, NULL);
+    close(fd);
+    memo_stats.hits++;
+    return header.status;
+  }
+  if (fd >= 0) close(fd);
+
+  // a miss runs the pipeline with its output going to a new entry (after room for the
+  // header), and then replays it. the entry only appears once it's complete:
+  std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+  int out = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (out < 0 || lseek(out, sizeof(header), SEEK_SET) < 0) {
+    fprintf(stderr, "[memo] error: %s: %s\n", tmp_path.c_str(), strerror(errno));
+    if (out >= 0) close(out);
+    memo_stats.uncached++;
+    return run_pipeline(plan, pipeline, false);
+  }
+  int saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+  dup2(out, STDOUT_FILENO);
+  int status = run_pipeline(plan, pipeline, false);
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+
+  // commands killed by a signal (e.g. CTRL+C) may not have finished their output:
+  off_t size = lseek(out, 0, SEEK_END) - sizeof(header);
+  memcpy(header.magic, "MEMO", 4);
+  header.status = status;
+  header.size = size;
+  if (status < 128 && pwrite(out, &header, sizeof(header), 0) == sizeof(header)) rename(tmp_path.c_str(), path.c_str());
+  else unlink(tmp_path.c_str());
+  memo_stats.misses++;
+
+  lseek(out, sizeof(header), SEEK_SET);
+  sigaction(SIGPIPE, &ignore, &orig_pipe);
+  copy_fd(out, STDOUT_FILENO);
+  sigaction(SIGPIPE, &orig_pipe, NULL);
+  close(out);
+  memo_evict(dir);
+  return status;
 }
 
+uint64_t memo_key(const PipelinePlan& pipeline, const std::vector<std::string>& inputs,
+                  const std::vector<std::string>& vars) {
+  uint64_t hash = 14695981039346656037ULL;
+
+  // the expanded words and redirections of every stage, so spacing and quoting styles
+  // don't matter (a subshell is taken as written):
+  Launch launch;
+  for (const CommandPlan& stage : pipeline.stages) {
+    if (stage.subshell >= 0) hash = fnv1a(stage.text.c_str(), stage.text.size() + 1, hash);
+    prepare_launch(stage, launch);
+    for (size_t i = 0; launch.argv[i]; i++) hash = fnv1a(launch.argv[i], strlen(launch.argv[i]) + 1, hash);
+    for (const Redirect& redirect : launch.redirects) {
+      hash = fnv1a(&redirect.fd, sizeof(redirect.fd), hash);
+      hash = fnv1a(&redirect.copy_of, sizeof(redirect.copy_of), hash);
+      if (redirect.path) hash = fnv1a(redirect.path, strlen(redirect.path) + 1, hash);
+      else hash = fnv1a(redirect.here_text.data(), redirect.here_text.size(), hash);
+    }
+    hash = fnv1a("|", 1, hash);
+  }
+
+  // where it runs, and what it sees of the environment:
+  char cwd[4096];
+  if (getcwd(cwd, sizeof(cwd))) hash = fnv1a(cwd, strlen(cwd) + 1, hash);
+  std::vector<std::string> names = {"PATH"};
+  names.insert(names.end(), vars.begin(), vars.end());
+  for (const std::string& var : names) {
+    const char* value = getenv(var.c_str());
+    hash = fnv1a(var.c_str(), var.size() + 1, hash);
+    if (value) hash = fnv1a(value, strlen(value) + 1, hash);
+  }
+
+  // the input files as the kernel describes them (a missing file hashes as such):
+  for (const std::string& input : inputs) {
+    struct stat st = {};
+    hash = fnv1a(input.c_str(), input.size() + 1, hash);
+    if (stat(input.c_str(), &st) == -1) continue;
+    hash = fnv1a(&st.st_size, sizeof(st.st_size), hash);
+    hash = fnv1a(&st.st_mtim, sizeof(st.st_mtim), hash);
+  }
+  return hash;
+}
+
+uint64_t fnv1a(const void* data, size_t len, uint64_t hash) {
+  const unsigned char* bytes = (const unsigned char*) data;
+  for (size_t i = 0; i < len; i++) hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  return hash;
+}
+
+// the directory holding the memo cache ($XDG_CACHE_HOME/myshell/memo, or under
+// ~/.cache), created if needed. empty if there is none:
+std::string memo_dir() {
+  std::string dir = cache_dir("memo");
+  if (dir.empty() && errno) fprintf(stderr, "[memo] error: could not create the cache: %s\n", strerror(errno));
+  return dir;
+}
+
+// our directory under $XDG_CACHE_HOME (or ~/.cache), or the named one inside it, created
+// if needed. empty if there is none (errno tells why, 0 without a home directory):
+std::string cache_dir(const char* name) {
+  std::string dir;
+  if (getenv("XDG_CACHE_HOME") && *getenv("XDG_CACHE_HOME")) dir = getenv("XDG_CACHE_HOME");
+  else if (getenv("HOME")) dir = std::string(getenv("HOME")) + "/.cache";
+  else {
+    errno = 0;
+    return "";
+  }
+  dir += "/myshell";
+  if (name) dir += "/" + std::string(name);
+
+  // create every missing directory along the way:
+  for (size_t slash = 1; slash != std::string::npos; slash = dir.find('/', slash + 1)) {
+    mkdir(dir.substr(0, slash).c_str(), 0755);
+  }
+  if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST) return "";
+  return dir;
+}
+
+// removes the least recently used entries until the cache fits in memo_size:
+void memo_evict(const std::string& dir) {
+  DIR* stream = opendir(dir.c_str());
+  if (!stream) return;
+  struct Entry {
+    struct timespec used;
+    off_t size;
+    std::string name;
+  };
+  std::vector<Entry> entries;
+  off_t total = 0;
+  while (struct dirent* ent = readdir(stream)) {
+    struct stat st;
+    if (ent->d_name[0] == '.' || strchr(ent->d_name, '.')) continue; // skip unfinished entries
+    if (fstatat(dirfd(stream), ent->d_name, &st, 0) == -1) continue;
+    entries.push_back({st.st_mtim, st.st_size, ent->d_name});
+    total += st.st_size;
+  }
+  if (total > memo_size) {
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+      return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec : a.used.tv_nsec < b.used.tv_nsec;
+    });
+    for (size_t i = 0; i < entries.size() && total > memo_size; i++) {
+      if (unlinkat(dirfd(stream), entries[i].name.c_str(), 0) == -1) continue;
+      total -= entries[i].size;
+      memo_stats.evicted++;
+    }
+  }
+  closedir(stream);
+}
+
+int memo_stats_report() {
+  long lookups = memo_stats.hits + memo_stats.misses;
+  printf("hits %ld, misses %ld, hit rate %.1f%%\n", memo_stats.hits, memo_stats.misses,
+         lookups ? 100.0 * memo_stats.hits / lookups : 0.0);
+  printf("uncached %ld, evicted %ld\n", memo_stats.uncached, memo_stats.evicted);
+
+  // what's on disk right now, shared with every other shell:
+  std::string dir = memo_dir();
+  DIR* stream = dir.empty() ? NULL : opendir(dir.c_str());
+  if (!stream) return 1;
+  long count = 0;
+  off_t total = 0;
+  while (struct dirent* ent = readdir(stream)) {
+    struct stat st;
+    if (ent->d_name[0] == '.' || strchr(ent->d_name, '.')) continue;
+    if (fstatat(dirfd(stream), ent->d_name, &st, 0) == -1) continue;
+    count++;
+    total += st.st_size;
+  }
+  closedir(stream);
+  printf("%ld entries, %ldK of %ldK in %s\n", count, (long) total / 1024, memo_size / 1024, dir.c_str());
+  return 0;
+}
+
+/* ---------- RESOURCE LIMITS ---------- */
+
+// runs 'limit key=value... cmd', where the keys are cpu (CPUs), mem, io (a line for
+// io.max) and pids, enforced by a cgroup v2 leaf made for the job, and cputime
+// (seconds), nofile and core, set with setrlimit() in each process:
+int run_limited(const Plan& plan, int pc, bool background) {
+  const Step& step = plan.steps[pc];
+  Limits limits;
+  Launch settings;
+  expand_args(step.args, settings);
+  for (size_t i = 0; settings.argv[i]; i++) {
+    std::string word = settings.argv[i];
+    size_t eq = word.find('=');
+    if (!add_limit(limits, word.substr(0, eq), word.substr(eq + 1))) return 1;
+    if (!limits.text.empty()) limits.text += ' ';
+    limits.text += word;
+  }
+  if (step.next == pc + 1) {
+    fprintf(stderr, "[limit] error: usage: limit key=value... command\n");
+    return 1;
+  }
+  return run_pipeline(plan, plan.pipelines[plan.steps[pc + 1].arg], background, NULL, &limits);
+}
+
+bool add_limit(Limits& limits, const std::string& key, const std::string& value) {
+  long size;
+  char* end;
+  if (key == "cpu") {
+    double cpus = strtod(value.c_str(), &end);
+    if (*end || cpus <= 0) return bad_limit(key, value);
+    limits.cgroup.emplace_back("cpu.max", std::to_string((long) (cpus * CPU_PERIOD)) + " " + std::to_string(CPU_PERIOD));
+  }
+  else if (key == "mem") {
+    if (!parse_size(value.c_str(), size)) return bad_limit(key, value);
+    limits.cgroup.emplace_back("memory.max", std::to_string(size));
+    limits.mem = size;
+  }
+  else if (key == "io") limits.cgroup.emplace_back("io.max", value);
+  else if (key == "pids") {
+    size = strtol(value.c_str(), &end, 10);
+    if (*end || size <= 0) return bad_limit(key, value);
+    limits.cgroup.emplace_back("pids.max", value);
+  }
+  else if (key == "cputime" || key == "nofile") {
+    size = strtol(value.c_str(), &end, 10);
+    if (*end || size < 0) return bad_limit(key, value);
+    limits.rlimits.emplace_back(key == "cputime" ? RLIMIT_CPU : RLIMIT_NOFILE, size);
+  }
+  else if (key == "core") {
+    if (!parse_size(value.c_str(), size)) return bad_limit(key, value);
+    limits.rlimits.emplace_back(RLIMIT_CORE, size);
+  }
+  else {
+    fprintf(stderr, "[limit] error: unknown limit %s.\n", key.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool bad_limit(const std::string& key, const std::string& value) {
+  fprintf(stderr, "[limit] error: invalid value for %s: %s.\n", key.c_str(), value.c_str());
+  return false;
+}
+
+// the cgroup v2 directory our job leaves go in: $MYSHELL_CGROUP, or the shell's own
+// cgroup. empty if there's no cgroup v2 hierarchy:
+const std::string& cgroup_base() {
+  static std::string base;
+  static bool found = false;
+  if (found) return base;
+  found = true;
+  if (getenv("MYSHELL_CGROUP") && *getenv("MYSHELL_CGROUP")) return base = getenv("MYSHELL_CGROUP");
+
+  // where cgroup2 is mounted, and where we are in it:
+  std::string mount, self;
+  FILE* file = fopen("/proc/self/mounts", "r");
+  char dev[256], dir[PATH_MAX], type[64];
+  while (file && fscanf(file, "%255s %4095s %63s %*[^\n]", dev, dir, type) == 3) {
+    if (!strcmp(type, "cgroup2")) mount = dir;
+  }
+  if (file) fclose(file);
+  file = fopen("/proc/self/cgroup", "r");
+  char line[PATH_MAX];
+  while (file && fgets(line, sizeof(line), file)) {
+    if (!strncmp(line, "0::", 3)) self = std::string(line + 3, strcspn(line + 3, "\n"));
+  }
+  if (file) fclose(file);
+  if (!mount.empty()) base = mount + (self == "/" ? "" : self);
+  return base;
+}
+
+// makes a cgroup leaf for the job and applies its limits there. settings the hierarchy
+// doesn't support (e.g. a controller that isn't delegated to us) fall back to rlimits
+// where there is one, and are reported otherwise:
+void setup_job_limits(int job_id, Limits& limits) {
+  const std::string& base = cgroup_base();
+  std::string leaf = base.empty() ? "" : base + "/myshell-" + std::to_string(getpid()) + "-" + std::to_string(job_id);
+  if (!leaf.empty() && mkdir(leaf.c_str(), 0755) == -1) leaf.clear();
+
+  // controllers have to be enabled for our children. that fails while base holds
+  // processes (e.g. the shell itself), which can't hand out controllers at the same time.
+  // the shell isn't moved out of the user's cgroup for it, so rlimits are used instead:
+  for (const auto& setting : limits.cgroup) {
+    if (leaf.empty()) break;
+    std::string controller = "+" + setting.first.substr(0, setting.first.find('.'));
+    if (!write_file(base + "/cgroup.subtree_control", controller) && errno == EBUSY) {
+      fprintf(stderr, "[limit] warning: %s has processes in it, so its controllers can't be used "
+              "(set $MYSHELL_CGROUP to a delegated cgroup).\n", base.c_str());
+      break;
+    }
+  }
+
+  bool mem_done = false;
+  for (const auto& setting : limits.cgroup) {
+    if (!leaf.empty() && write_file(leaf + "/" + setting.first, setting.second)) {
+      mem_done |= setting.first == "memory.max";
+      continue;
+    }
+    if (setting.first == "memory.max") continue;
+    if (setting.first == "pids.max") {
+      limits.rlimits.emplace_back(RLIMIT_NPROC, atol(setting.second.c_str())); // per user, so only roughly
+      continue;
+    }
+    fprintf(stderr, "[limit] warning: %s is not available, so it isn't limited.\n", setting.first.c_str());
+  }
+  if (limits.mem >= 0 && !mem_done) limits.rlimits.emplace_back(RLIMIT_AS, limits.mem);
+
+  limits.cgroup_fd = leaf.empty() ? -1 : open((leaf + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+  if (limits.cgroup_fd < 0 && !leaf.empty()) {
+    rmdir(leaf.c_str());
+    leaf.clear();
+  }
+  Job& job = jobs[job_id];
+  job.limits = limits.text;
+  job.cgroup = leaf;
+}
+
+// in the new process, before it execs:
+void apply_limits(const Limits& limits) {
+  if (limits.cgroup_fd >= 0 && write(limits.cgroup_fd, "0", 1) != 1) {
+    fprintf(stderr, "[limit] error: could not join the job's cgroup: %s\n", strerror(errno));
+    _exit(126);
+  }
+  for (const auto& limit : limits.rlimits) {
+    struct rlimit rl;
+    getrlimit(limit.first, &rl);
+    rl.rlim_cur = limit.second;
+    if (rl.rlim_max != RLIM_INFINITY && rl.rlim_max < rl.rlim_cur) rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(limit.first, &rl) == -1) {
+      fprintf(stderr, "[limit] error: setrlimit: %s\n", strerror(errno));
+      _exit(126);
+    }
+  }
+}
+
+// the CPU time (in microseconds) and memory (current, or peak if the kernel keeps it)
+// used by everything in a cgroup, -1 where unknown:
+void read_cgroup_usage(const std::string& cgroup, long& cpu_usec, long& mem) {
+  cpu_usec = mem = -1;
+  FILE* file = fopen((cgroup + "/cpu.stat").c_str(), "r");
+  if (file) {
+    if (fscanf(file, "usage_usec %ld", &cpu_usec) != 1) cpu_usec = -1;
+    fclose(file);
+  }
+  for (const char* name : {"/memory.peak", "/memory.current"}) {
+    file = fopen((cgroup + name).c_str(), "r");
+    if (!file) continue;
+    if (fscanf(file, "%ld", &mem) != 1) mem = -1;
+    fclose(file);
+    break;
+  }
+}
+
+// once every process of a job has exited, its cgroup's totals are kept in the job and
+// the leaf is removed (unless something the job started is still in there):
+void finish_job_cgroup(Job& job) {
+  if (job.cgroup.empty()) return;
+  read_cgroup_usage(job.cgroup, job.cgroup_cpu_usec, job.cgroup_mem);
+  rmdir(job.cgroup.c_str());
+  job.cgroup_done = true;
+}
+
+void print_job_limits(const Job& job) {
+  if (job.limits.empty()) return;
+  printf("     limits: %s\n", job.limits.c_str());
+  if (job.cgroup.empty()) return;
+  long cpu_usec = job.cgroup_cpu_usec, mem = job.cgroup_mem;
+  if (!job.cgroup_done) read_cgroup_usage(job.cgroup, cpu_usec, mem);
+  printf("     cgroup %s: cpu %ld.%03lds", job.cgroup.c_str(), cpu_usec / 1000000, cpu_usec / 1000 % 1000);
+  if (mem >= 0) printf(", memory %ld KiB", mem / 1024);
+  printf("\n");
+}
+
+bool write_file(const std::string& path, const std::string& text) {
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  bool ok = write(fd, text.data(), text.size()) == (ssize_t) text.size();
+  int err = errno;
+  close(fd);
+  errno = err;
+  return ok;
+}
+
+/* ---------- CPU PINNING ---------- */
+
+// 'pin CPUS|auto [mem=NODES] pipeline' runs every stage of the pipeline on the given CPUs
+// (a list like 0-3,8), with its memory bound to the given NUMA nodes. with 'auto', the
+// stages get a CPU each, next to each other in one last-level cache:
+int run_pinned(const Plan& plan, int pc, bool background) {
+  const Step& step = plan.steps[pc];
+  Launch words;
+  expand_args(step.args, words);
+  if (!words.argv[0] || step.next == pc + 1) {
+    fprintf(stderr, "[pin] error: usage: pin CPUS|auto [mem=NODES] command\n");
+    return 1;
+  }
+  Pin pin;
+  for (size_t i = 0; words.argv[i]; i++) {
+    std::string_view word = words.argv[i];
+    unsigned long nodes;
+    if (word.substr(0, 4) == "mem=") {
+      if (!parse_node_mask(word.substr(4), nodes)) {
+        fprintf(stderr, "[pin] error: invalid NUMA node list %s.\n", words.argv[i] + 4);
+        return 1;
+      }
+      pin.placement.nodes |= nodes;
+    }
+    else if (i == 0 && word == "auto") pin.automatic = true;
+    else if (i > 0 || !parse_cpu_set(word, pin.placement.cpus)) {
+      fprintf(stderr, "[pin] error: invalid CPU list %s.\n", words.argv[i]);
+      return 1;
+    }
+  }
+  return run_pipeline(plan, plan.pipelines[plan.steps[pc + 1].arg], background, NULL, NULL, &pin);
+}
+
+// a list of ids like '0-3,8,10-11' (in the form of sysfs's CPU lists), in order:
+bool parse_id_list(std::string_view text, std::vector<int>& ids) {
+  ids.clear();
+  while (!text.empty()) {
+    size_t comma = std::min(text.find(','), text.size());
+    std::string part(text.substr(0, comma));
+    text.remove_prefix(std::min(comma + 1, text.size()));
+    char* end;
+    long first = strtol(part.c_str(), &end, 10), last = first;
+    if (end == part.c_str() || first < 0) return false;
+    if (*end == '-') {
+      const char* start = end + 1;
+      last = strtol(start, &end, 10);
+      if (end == start || last < first) return false;
+    }
+    if (*end || last > 65535) return false;
+    for (long id = first; id <= last; id++) ids.push_back(id);
+  }
+  return !ids.empty();
+}
+
+// the list in a sysfs file (like a cache's shared_cpu_list):
+bool read_id_list(const std::string& path, std::vector<int>& ids) {
+  FILE* file = fopen(path.c_str(), "r");
+  if (!file) return false;
+  char line[4096];
+  bool ok = fgets(line, sizeof(line), file) != NULL;
+  fclose(file);
+  if (!ok) return false;
+  line[strcspn(line, "\n")] = '\0';
+  return parse_id_list(line, ids);
+}
+
+bool parse_cpu_set(std::string_view text, cpu_set_t& cpus) {
+  std::vector<int> ids;
+  // the ids are in the order they were written, so every one is checked:
+  if (!parse_id_list(text, ids) || *std::max_element(ids.begin(), ids.end()) >= CPU_SETSIZE) return false;
+  CPU_ZERO(&cpus);
+  for (int cpu : ids) CPU_SET(cpu, &cpus);
+  return true;
+}
+
+// a node list as the bits of a set_mempolicy() mask, which only has room for 64:
+bool parse_node_mask(std::string_view text, unsigned long& nodes) {
+  std::vector<int> ids;
+  if (!parse_id_list(text, ids) || *std::max_element(ids.begin(), ids.end()) >= 64) return false;
+  nodes = 0;
+  for (int node : ids) nodes |= 1UL << node;
+  return true;
+}
+
+// works out where each stage of a pipeline runs, from 'pin' and from the '|@cpus' before
+// a stage (which wins). placements stays empty if nothing is pinned:
+bool place_stages(const PipelinePlan& piped, const Pin* pin, std::vector<Placement>& placements) {
+  bool pinned = pin != NULL;
+  for (const CommandPlan& stage : piped.stages) pinned |= !stage.cpus.raw.empty();
+  if (!pinned) return true;
+
+  // every pipeline of 'pin auto' goes to the next cache group, so they spread out:
+  static size_t next_group = 0;
+  const CacheGroup* group = NULL;
+  if (pin && pin->automatic && !cache_groups().empty()) group = &cache_groups()[next_group++ % cache_groups().size()];
+
+  placements.assign(piped.stages.size(), Placement());
+  for (size_t i = 0; i < piped.stages.size(); i++) {
+    Placement& placement = placements[i];
+    if (group) {
+      CPU_SET(group->cpus[i % group->cpus.size()], &placement.cpus);
+      if (group->node >= 0) {
+        placement.nodes = 1UL << group->node;
+        placement.policy = MPOL_PREFERRED;
+      }
+    }
+    else if (pin) placement = pin->placement;
+    if (pin && pin->placement.nodes) {
+      placement.nodes = pin->placement.nodes;
+      placement.policy = MPOL_BIND;
+    }
+
+    const Word& cpus = piped.stages[i].cpus;
+    if (cpus.raw.empty()) continue;
+    Launch word;
+    expand_args({cpus}, word);
+    if (!word.argv[0] || !parse_cpu_set(word.argv[0], placement.cpus)) {
+      fprintf(stderr, "[pin] error: invalid CPU list %s.\n", word.argv[0] ? word.argv[0] : cpus.raw.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+// the CPUs we may run on, grouped by the last-level cache they share, and within a group
+// with the ones sharing an L2 (e.g. SMT siblings) next to each other. read from sysfs once:
+const std::vector<CacheGroup>& cache_groups() {
+  static std::vector<CacheGroup> groups;
+  static bool read = false;
+  if (read) return groups;
+  read = true;
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) return groups;
+
+  // the node of every CPU, if there's more than one node:
+  std::vector<int> node_of(CPU_SETSIZE, -1), ids;
+  int nodes = 0;
+  for (int node = 0; node < 64; node++) {
+    if (!read_id_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", ids)) continue;
+    nodes++;
+    for (int cpu : ids) if (cpu < CPU_SETSIZE) node_of[cpu] = node;
+  }
+
+  // each CPU is keyed by the first CPU of its last-level and L2 caches:
+  std::vector<std::tuple<int, int, int>> keyed;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed)) continue;
+    int llc = cpu, l2 = cpu, llc_level = 0;
+    std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index";
+    for (int index = 0;; index++) {
+      std::vector<int> level, shared;
+      if (!read_id_list(base + std::to_string(index) + "/level", level)) break;
+      if (!read_id_list(base + std::to_string(index) + "/shared_cpu_list", shared)) continue;
+      if (level[0] == 2) l2 = shared[0];
+      if (level[0] >= llc_level) {
+        llc_level = level[0];
+        llc = shared[0];
+      }
+    }
+    keyed.emplace_back(llc, l2, cpu);
+  }
+  std::sort(keyed.begin(), keyed.end());
+  for (size_t i = 0; i < keyed.size(); i++) {
+    auto [llc, l2, cpu] = keyed[i];
+    if (i == 0 || std::get<0>(keyed[i - 1]) != llc) {
+      groups.emplace_back();
+      groups.back().node = nodes > 1 ? node_of[cpu] : -1;
+    }
+    groups.back().cpus.push_back(cpu);
+  }
+  return groups;
+}
+
+// in the new process: a preferred node is only a hint (it's what 'pin auto' sets), so
+// only CPUs and bound memory fail the stage if they can't be had:
+void apply_placement(const Placement& placement) {
+  if (CPU_COUNT(&placement.cpus) && sched_setaffinity(0, sizeof(placement.cpus), &placement.cpus) == -1) {
+    fprintf(stderr, "[pin] error: sched_setaffinity: %s\n", strerror(errno));
+    _exit(126);
+  }
+  if (placement.nodes && syscall(SYS_set_mempolicy, placement.policy, &placement.nodes,
+                                 sizeof(placement.nodes) * 8 + 1) == -1 && placement.policy == MPOL_BIND) {
+    fprintf(stderr, "[pin] error: set_mempolicy: %s\n", strerror(errno));
+    _exit(126);
+  }
+}
+
+/* ---------- ARGUMENT BATCHES ---------- */
+
+// the bytes one exec has for its arguments: ARG_MAX, less our environment (which goes
+// along with them) and some headroom. every argument takes its pointer too:
+long arg_room() {
+  long room = sysconf(_SC_ARG_MAX);
+  if (room <= 0) room = 128 << 10;
+  for (char** env = environ; *env; env++) room -= strlen(*env) + 1 + sizeof(char*);
+  return room - ARG_HEADROOM;
+}
+
+// how many of argv go into every batch: the command, and the options right after it
+// (so 'batch rm -f *.o' removes every file with -f):
+size_t fixed_args(char* const* argv) {
+  size_t fixed = 1;
+  while (argv[fixed] && argv[fixed][0] == '-') fixed++;
+  return fixed;
+}
+
+// runs argv[0] with the first fixed arguments and as many of the rest as fit in one exec
+// (or max_args of them, if it's above 0), and again with the next ones until every one
+// has been given to it. at most parallel of them run at a time, and the status is that
+// of the first batch that failed:
+int run_batches(char* const* argv, size_t fixed, long parallel, long max_args) {
+  long room = arg_room();
+  for (size_t i = 0; i < fixed; i++) room -= strlen(argv[i]) + 1 + sizeof(char*);
+
+  // the batches' argv point into ours, so the list itself is never copied:
+  Launch launch;
+  std::vector<int> running;
+  int first_failure = 0;
+  bool was_batching = batching;
+  batching = true;
+  for (size_t next = fixed; argv[next] || !running.empty();) {
+    if (!argv[next] || (long) running.size() >= parallel) {
+      int status;
+      wait_any(running, status);
+      if (status && !first_failure) first_failure = status;
+      continue;
+    }
+
+    launch.argv.assign(argv, argv + fixed);
+    size_t start = next;
+    for (long left = room; argv[next] && (max_args <= 0 || (long) (next - start) < max_args); next++) {
+      long size = strlen(argv[next]) + 1 + sizeof(char*);
+      if (size > left || size > ARG_STRLEN_MAX) break;
+      left -= size;
+      launch.argv.push_back(argv[next]);
+    }
+    if (next == start) {
+      fprintf(stderr, "[batch] error: %.32s...: %s\n", argv[next], strerror(E2BIG));
+      if (!first_failure) first_failure = 1;
+      next++;
+      continue;
+    }
+    launch.argv.push_back(NULL);
+
+    std::string text = std::string(argv[0]) + " (" + std::to_string(start - fixed + 1) + "-" +
+                       std::to_string(next - fixed) + ")";
+    pid_t pid = spawn_stage(launch, {}, false);
+    if (pid < 0) {
+      if (!first_failure) first_failure = 127;
+      continue;
+    }
+    int job_id = add_job(text, false);
+    add_process(job_id, pid, text);
+    running.push_back(job_id);
+  }
+  batching = was_batching;
+  return first_failure;
+}
+
+// 'set autobatch on' runs a stage whose arguments don't fit in one exec in batches (one at
+// a time), by a copy of the shell that is the stage's process:
+pid_t fork_batches(const Launch& launch, const std::vector<std::pair<int, int>>& moves, bool is_background) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) print_error(0);
+  if (pid) return pid;
+
+  if (is_background) setpgid(0, 0);
+  for (const auto& move : moves) dup2(move.second, move.first);
+  interactive = false;
+  jobs.clear();
+  job_pids.clear();
+  zygote_stop();
+  zygote_size = 0;
+  export_assigns(launch);
+  int status = run_batches(launch.argv.data(), fixed_args(launch.argv.data()), 1, 0);
+  fflush(stdout);
+  _exit(status);
+}
+
+bool set_autobatch(const char* arg) {
+  if (!strcmp(arg, "on") || !strcmp(arg, "1")) autobatch = 1;
+  else if (!strcmp(arg, "off") || !strcmp(arg, "0")) autobatch = 0;
+  else {
+    fprintf(stderr, "[set] error: usage: set autobatch on|off\n");
+    return false;
+  }
+  return true;
+}
+
+// 'batch [-P N] [-n N] cmd [-options] args...' is like xargs with the arguments given
+// right there: cmd runs with as many of them as fit in one exec (or N of them with -n),
+// and up to N of those at a time with -P:
+int handle_batch(int argc, char** argv) {
+  long parallel = 1, max_args = 0;
+  int i = 1;
+  for (; i < argc && (!strncmp(argv[i], "-P", 2) || !strncmp(argv[i], "-n", 2)); i++) {
+    char flag = argv[i][1];
+    long& option = flag == 'P' ? parallel : max_args;
+    const char* value = argv[i][2] || i + 1 == argc ? argv[i] + 2 : argv[++i];
+    char* end;
+    option = strtol(value, &end, 10);
+    if (end == value || *end || option < 1) {
+      fprintf(stderr, "[batch] error: invalid -%c value %s.\n", flag, value);
+      return 1;
+    }
+  }
+  if (i == argc) {
+    fprintf(stderr, "[batch] error: usage: batch [-P N] [-n N] command [-options] args...\n");
+    return 1;
+  }
+  return run_batches(argv + i, fixed_args(argv + i), parallel, max_args);
+}
+
+/* ---------- REMOTE FAN-OUT ---------- */
+
+// a host an '@hosts' command runs on, and what it has printed so far:
+struct RemoteRun {
+  std::string host;
+  int job_id = 0; // of its ssh, while it's running
+  int fd = -1; // the read end of its STDOUT and STDERR
+  std::string partial; // output after its last newline
+  bool output = false; // whether it has printed anything yet
+  int status = -1;
+  double seconds = 0;
+};
+
+// '@host1,host2,... pipeline' runs the pipeline, as written, on every host at once (at most
+// 'set fanout' of them at a time). every line of output is prefixed with the host it came
+// from, and a table of each host's status and latency follows. its status is that of the
+// first listed host that failed:
+int run_remote(const Plan& plan, int pc) {
+  const Step& step = plan.steps[pc];
+  Launch hosts_arg;
+  expand_args(step.args, hosts_arg);
+  std::vector<RemoteRun> runs;
+  size_t width = 0;
+  for (size_t i = 0; hosts_arg.argv[i]; i++) {
+    for (std::string_view rest = hosts_arg.argv[i]; !rest.empty();) {
+      size_t comma = std::min(rest.find(','), rest.size());
+      if (comma) {
+        runs.emplace_back();
+        runs.back().host = rest.substr(0, comma);
+        width = std::max(width, comma);
+      }
+      rest.remove_prefix(std::min(comma + 1, rest.size()));
+    }
+  }
+  if (runs.empty() || step.next == pc + 1) {
+    fprintf(stderr, "[@] error: usage: @host1,host2,... command\n");
+    return 1;
+  }
+  const char* ssh = resolve_cmd("ssh");
+  if (!ssh) {
+    fprintf(stderr, "[@] error: ssh: command not found\n");
+    return 127;
+  }
+  const std::string& command = plan.pipelines[plan.steps[pc + 1].arg].text;
+
+  // each host's connection is kept open by a master process for the next command, with
+  // its socket in a directory only we can get into:
+  std::string control = cache_dir("ssh");
+  if (!control.empty() && chmod(control.c_str(), 0700) == -1) control.clear();
+
+  // SIGCHLD is only let in while waiting for output, so an ssh that exits can't be missed
+  // (its output ends when it exits, even if the master it started still holds the pipe):
+  sigset_t chld, orig;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, &orig);
+  size_t next = 0, running = 0;
+  std::vector<struct pollfd> fds;
+  std::vector<size_t> polled;
+  while (next < runs.size() || running) {
+    while (next < runs.size() && (long) running < fanout) {
+      RemoteRun& run = runs[next++];
+      if (start_remote(run, ssh, control, command)) running++;
+    }
+
+    update_jobs();
+    for (RemoteRun& run : runs) {
+      auto job = run.job_id ? jobs.find(run.job_id) : jobs.end();
+      if (job == jobs.end() || job->second.remaining) continue;
+      remote_output(run, width, true);
+      if (run.fd >= 0) close(run.fd);
+      Job finished;
+      run.status = wait_job(run.job_id, &finished);
+      run.seconds = seconds_between(finished.procs[0].start, finished.procs[0].end);
+      run.job_id = 0;
+      running--;
+    }
+    if (!running) continue;
+
+    fds.clear();
+    polled.clear();
+    for (size_t i = 0; i < runs.size(); i++) {
+      if (!runs[i].job_id || runs[i].fd < 0) continue;
+      fds.push_back({runs[i].fd, POLLIN, 0});
+      polled.push_back(i);
+    }
+    if (ppoll(fds.data(), fds.size(), NULL, &orig) <= 0) continue;
+    for (size_t i = 0; i < fds.size(); i++) {
+      if (!fds[i].revents) continue;
+      RemoteRun& run = runs[polled[i]];
+      remote_output(run, width, false);
+
+      // a closed pipe is done with, even though the ssh may still be exiting:
+      if (fds[i].revents & (POLLHUP | POLLERR) && !(fds[i].revents & POLLIN)) {
+        close(run.fd);
+        run.fd = -1;
+      }
+    }
+  }
+  sigprocmask(SIG_SETMASK, &orig, NULL);
+
+  fprintf(stderr, "%-24s %7s %10s\n", "host", "status", "time");
+  for (const RemoteRun& run : runs) fprintf(stderr, "%-24.24s %7d %9.3fs\n", run.host.c_str(), run.status, run.seconds);
+  for (const RemoteRun& run : runs) if (run.status) return run.status;
+  return 0;
+}
+
+// starts 'ssh host command' for a run, with its output going to a pipe of its own that we
+// read without blocking. false (with the status set) if it couldn't be started:
+bool start_remote(RemoteRun& run, const char* ssh, const std::string& control, const std::string& command) {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) == -1) {
+    fprintf(stderr, "[@] error: %s: %s\n", run.host.c_str(), strerror(errno));
+    run.status = 1;
+    return false;
+  }
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+  // BatchMode keeps ssh from prompting (there's no terminal to answer it on), and '--'
+  // keeps a host from being taken as an option:
+  std::string control_path = "ControlPath=" + control + "/%C";
+  std::vector<const char*> argv = {"ssh", "-o", "BatchMode=yes"};
+  if (!control.empty()) {
+    argv.insert(argv.end(), {"-o", "ControlMaster=auto", "-o", "ControlPersist=" SSH_PERSIST, "-o",
+                             control_path.c_str()});
+  }
+  argv.insert(argv.end(), {"--", run.host.c_str(), command.c_str(), NULL});
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+  pid_t pid;
+  int err = posix_spawn(&pid, ssh, &actions, NULL, (char**) argv.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[1]);
+  if (err) {
+    fprintf(stderr, "[@] error: %s: %s\n", run.host.c_str(), strerror(err));
+    close(fds[0]);
+    run.status = 127;
+    return false;
+  }
+
+  run.fd = fds[0];
+  run.job_id = add_job(run.host + ": " + command, false);
+  add_process(run.job_id, pid, "ssh " + run.host);
+  return true;
+}
+
+// prints the complete lines a host has sent (and at the end, what's left), each prefixed
+// with the host:
+void remote_output(RemoteRun& run, size_t width, bool eof) {
+  char buf[READ_CHUNK];
+  ssize_t n;
+  while (run.fd >= 0 && ((n = read(run.fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR))) {
+    if (n > 0 && !run.output && tracing) trace_event("first-byte", trace_now(), NULL, 0, run.job_id, run.host);
+    if (n > 0) run.output = true;
+    if (n > 0) run.partial.append(buf, n);
+  }
+  size_t start = 0;
+  for (size_t end; (end = run.partial.find('\n', start)) != std::string::npos; start = end + 1) {
+    printf("%-*s | %.*s\n", (int) width, run.host.c_str(), (int) (end - start), run.partial.data() + start);
+  }
+  run.partial.erase(0, start);
+  if (eof && !run.partial.empty()) {
+    printf("%-*s | %s\n", (int) width, run.host.c_str(), run.partial.c_str());
+    run.partial.clear();
+  }
+  fflush(stdout);
+}
+
+/* ---------- PARALLEL GROUPS ---------- */
+
+// 'par [-j N] { cmd1 ; cmd2 ; ... }' runs the commands concurrently, at most N at a time
+// (by default one per online CPU). its status is that of the first listed command that failed:
+int run_par(const Plan& plan, int pc) {
+  // read the options before the '{':
+  const Step& step = plan.steps[pc];
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t limit = cpus < 1 ? 1 : cpus; // sysconf() may not know
+  Launch options;
+  expand_args(step.args, options);
+  for (size_t i = 0; options.argv[i]; i++) {
+    if (strncmp(options.argv[i], "-j", 2)) {
+      fprintf(stderr, "[par] error: usage: par [-j N] { cmd ; cmd ; ... }\n");
+      return 2;
+    }
+    const char* value = options.argv[i][2] ? options.argv[i] + 2 : options.argv[++i];
+    if (!value) {
+      fprintf(stderr, "[par] error: -j needs a number.\n");
+      return 2;
+    }
+    char* end;
+    long count = strtol(value, &end, 10);
+    if (end == value || *end || count < 1) {
+      fprintf(stderr, "[par] error: invalid job count %s (it must be at least 1).\n", value);
+      return 2;
+    }
+    limit = count;
+  }
+  const std::vector<int>& members = step.members;
+
+  std::vector<int> running; // job ids of the members still running
+  std::unordered_map<int, size_t> member_of; // job id -> index into members
+  std::vector<int> statuses(members.size(), 0);
+
+  for (size_t i = 0; i <= members.size(); i++) {
+    // wait for a free slot (or, at the end, for everything that's left):
+    while (!running.empty() && (running.size() >= limit || i == members.size())) {
+      int status;
+      int done = wait_any(running, status);
+      statuses[member_of[done]] = status;
+      member_of.erase(done);
+    }
+    if (i == members.size()) break;
+
+    // members never run in the shell itself, so they can't hold up the others:
+    int job_id = start_member(plan, members[i], step.texts[i], statuses[i]);
+    if (!job_id) continue;
+    running.push_back(job_id);
+    member_of[job_id] = i;
+  }
+
+  for (int status : statuses) if (status) return status;
+  return 0;
+}
+
+// starts a member of a parallel group without waiting for it: a pipeline as a job of its
+// own, anything else in a subshell. returns the id of the job (0 if there's none):
+int start_member(const Plan& plan, int start, const std::string& text, int& status) {
+  const Step& step = plan.steps[start];
+  if (step.op == STEP_PIPELINE && plan.steps[step.next].op == STEP_END) {
+    return start_pipeline(plan, plan.pipelines[step.arg], false, false, status);
+  }
+  pid_t pid = fork_subshell(plan, start, {}, {}, false);
+  if (pid < 0) {
+    status = 1;
+    return 0;
+  }
+  int job_id = add_job(text, false);
+  add_process(job_id, pid, text);
+  return job_id;
+}
+
+// expands a command's words into launch: variables are substituted (unquoted ones that
+// come to nothing are dropped), and then unquoted wildcards replaced by what they match:
+void prepare_launch(const CommandPlan& command, Launch& launch) {
+  prepare_words(command.words, command.redirects, !command.assignments, launch);
+  launch.assigns.clear();
+  launch.env.clear();
+  if (!command.env_words) return;
+
+  // 'NAME=value cmd' hands the command a copy of the environment with NAME in it (the
+  // words are never dropped or globbed, so they're still the first in argv):
+  std::vector<char*>& argv = launch.argv;
+  launch.assigns.assign(argv.begin(), argv.begin() + command.env_words);
+  argv.erase(argv.begin(), argv.begin() + command.env_words);
+  std::vector<char*>& env = launch.env;
+  for (char** entry = environ; *entry; entry++) env.push_back(*entry);
+  for (char* assign : launch.assigns) {
+    size_t name_len = strchr(assign, '=') - assign + 1;
+    auto same = std::find_if(env.begin(), env.end(), [&](char* entry) { return !strncmp(entry, assign, name_len); });
+    if (same != env.end()) *same = assign;
+    else env.push_back(assign);
+  }
+  env.push_back(NULL);
+}
+
+// the environment a command is started with:
+char** command_env(const Launch& launch) {
+  return launch.env.empty() ? environ : (char**) launch.env.data();
+}
+
+// in a copy of the shell that runs a command itself (a builtin, or batches), its own
+// 'NAME=value' words become exported variables:
+void export_assigns(const Launch& launch) {
+  for (std::string_view assign : launch.assigns) {
+    size_t eq = assign.find('=');
+    set_var(assign.substr(0, eq), assign.substr(eq + 1), true);
+  }
+}
+
+// just the words (e.g. the options of 'memo'), without globs:
+void expand_args(const std::vector<Word>& words, Launch& launch) {
+  prepare_words(words, {}, false, launch);
+}
+
+void prepare_words(const std::vector<Word>& words, const std::vector<RedirectPlan>& redirects,
+                   bool globs, Launch& launch) {
+  // buf is sized once up front (for the words and the values of their variables), so the
+  // pointers into it stay valid:
+  size_t room = 0;
+  std::string_view value;
+  auto measure = [&](const Word& word) {
+    room += word.raw.size() + 1;
+    for (size_t i = 0; word.expand && i < word.raw.size(); i++) {
+      if (word.raw[i] == '$' && var_ref(word.raw, i, value)) room += value.size();
+    }
+  };
+  for (const Word& word : words) measure(word);
+  for (const RedirectPlan& redirect : redirects) measure(redirect.target);
+  if (launch.buf.size() < room) launch.buf.resize(room);
+  char* out = launch.buf.data();
+  launch.argv.clear();
+  launch.redirects.clear();
+  launch.glob_args.clear();
+
+  // copies the word into the arena, dropping quotation marks. NULL if it's dropped (unless
+  // it must be kept, like the target of a redirection):
+  auto expand = [&](const Word& word, bool keep) -> char* {
+    char* start = out;
+    if (!word.expand) out = std::copy(word.literal.begin(), word.literal.end(), out);
+    else {
+      std::string_view raw = word.raw;
+      for (size_t i = 0, ref; i < raw.size();) {
+        if (raw[i] == '\"') i++;
+        else if (raw[i] == '$' && (ref = var_ref(raw, i, value))) {
+          i += ref;
+          out = std::copy(value.begin(), value.end(), out);
+        }
+        else *out++ = raw[i++];
+      }
+      // like in other shells, an unquoted variable that's empty isn't an argument at all:
+      if (out == start && !word.quoted && !keep) return NULL;
+    }
+    *out++ = '\0';
+    return start;
+  };
+
+  for (const Word& word : words) {
+    char* arg = expand(word, false);
+    if (!arg) continue;
+    if (word.wildcard) launch.glob_args.push_back(launch.argv.size());
+    launch.argv.push_back(arg);
+  }
+  launch.argv.push_back(NULL);
+
+  for (const RedirectPlan& plan : redirects) {
+    Redirect redirect = {plan.fd};
+    char* target = expand(plan.target, true);
+    switch (plan.kind) {
+      case REDIRECT_FILE:
+        redirect.flags = plan.flags;
+        redirect.path = target;
+        break;
+      case REDIRECT_COPY:
+        redirect.copy_of = atoi(target);
+        break;
+      case REDIRECT_HERE_STRING:
+        redirect.here = true;
+        redirect.here_text = target;
+        redirect.here_newline = true;
+        break;
+      case REDIRECT_HERE_DOC:
+        redirect.here = true;
+        if (plan.heredoc < (int) heredocs.size()) redirect.here_text = heredocs[plan.heredoc];
+        break;
+    }
+    launch.redirects.push_back(redirect);
+  }
+
+  // the arguments are complete, so wildcards can be replaced by what they match:
+  if (globs && !launch.glob_args.empty()) expand_globs(launch);
+}
+
+// works out what each descriptor of a stage becomes: the pipes around it, and then its
+// redirections in order. files and here-documents are opened by the shell (into opened,
+// which the caller closes once the stage has started), and moves gets the (target,
+// source) pairs to dup2() in the new process. no source is also a target, so they can be
+// done in any order. false if a redirection failed (after saying why):
+bool resolve_fds(const Launch& launch, int in_fd, int out_fd, std::vector<std::pair<int, int>>& moves,
+                 std::vector<int>& opened) {
+  moves.clear();
+  opened.clear();
+  if (in_fd >= 0) moves.push_back({STDIN_FILENO, in_fd});
+  if (out_fd >= 0) moves.push_back({STDOUT_FILENO, out_fd});
+  auto source_of = [&](int fd) {
+    for (const auto& move : moves) if (move.first == fd) return move.second;
+    return fd;
+  };
+  auto assign = [&](int fd, int source) {
+    for (auto& move : moves) {
+      if (move.first != fd) continue;
+      move.second = source;
+      return;
+    }
+    moves.push_back({fd, source});
+  };
+
+  for (const Redirect& redirect : launch.redirects) {
+    if (redirect.copy_of >= 0) {
+      int source = source_of(redirect.copy_of);
+      if (fcntl(source, F_GETFD) == -1) {
+        fprintf(stderr, "myShell: %d: %s\n", redirect.copy_of, strerror(EBADF));
+        return false;
+      }
+      assign(redirect.fd, source);
+      continue;
+    }
+    int fd = redirect.here ? open_here(redirect) : open(redirect.path, redirect.flags | O_CLOEXEC, RW_PERMS);
+    if (fd < 0) {
+      fprintf(stderr, "myShell: %s: %s\n", redirect.here ? "here-document" : redirect.path, strerror(errno));
+      return false;
+    }
+    opened.push_back(fd);
+    assign(redirect.fd, fd);
+  }
+
+  // a source that is also a target (or that would stay close-on-exec) gets out of the way:
+  auto end = std::remove_if(moves.begin(), moves.end(), [&](const std::pair<int, int>& move) {
+    bool ours = std::find(opened.begin(), opened.end(), move.second) != opened.end() || move.second == in_fd ||
+                move.second == out_fd;
+    return move.first == move.second && !ours;
+  });
+  moves.erase(end, moves.end());
+  for (auto& move : moves) {
+    bool collides = false;
+    for (const auto& other : moves) collides |= other.first == move.second;
+    if (!collides) continue;
+    int fd = fcntl(move.second, F_DUPFD_CLOEXEC, 10);
+    if (fd < 0) {
+      fprintf(stderr, "myShell: %d: %s\n", move.second, strerror(errno));
+      return false;
+    }
+    opened.push_back(fd);
+    move.second = fd;
+  }
+  return true;
+}
+
+// starts a stage of a pipeline (with its redirections) as a new process. returns its pid,
+// or -1 if it couldn't be started (REDIRECT_FAILED if its redirections couldn't be done):
+pid_t launch_stage(const Plan& plan, const CommandPlan& stage, const Launch& launch, const Pipeline& pipeline,
+                   size_t i, bool is_background) {
+  std::vector<std::pair<int, int>> moves;
+  std::vector<int> opened;
+  pid_t pid = REDIRECT_FAILED;
+  if (resolve_fds(launch, stage_input(pipeline, i), stage_output(pipeline, i), moves, opened)) {
+    if (stage.subshell >= 0) {
+      pid = fork_subshell(plan, stage.subshell, moves, pipeline.fds, is_background, launch.limits,
+                          launch.placement);
+    }
+    else pid = spawn_stage(launch, moves, is_background);
+  }
+  for (int fd : opened) close(fd);
+  return pid;
+}
+
+pid_t spawn_stage(const Launch& launch, const std::vector<std::pair<int, int>>& moves, bool is_background) {
+  // nothing to execute:
+  if (launch.argv[0] == NULL) {
+    print_error(1);
+    return -1;
+  }
+
+  // builtins can't be exec'd, so they need a forked copy of the shell:
+  if (BUILTINS.count(launch.argv[0])) return fork_stage(NULL, launch, moves, is_background);
+
+  // neither posix_spawn() nor a zygote can set limits (or CPUs and memory), so limited and
+  // pinned commands are forked:
+  if (launch.limits || launch.placement) {
+    const char* path = resolve_cmd(launch.argv[0]);
+    if (!path) {
+      print_error(3);
+      return -1;
+    }
+    return fork_stage(path, launch, moves, is_background);
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // a ready helper from the zygote pool only has to exec (without the shell waiting for
+  // it), and posix_spawn() is used when there's none:
+  if (zygote_size > 0) {
+    const char* path = resolve_cmd(launch.argv[0]);
+    pid_t pid = path ? zygote_launch(path, launch, moves, is_background) : -1;
+    if (pid > 0) {
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      launch_stats.zygote++;
+      launch_stats.zygote_us += seconds_between(start, end) * 1e6; // until it was handed over
+      return pid;
+    }
+    launch_stats.zygote_misses++;
+  }
+
+  // the descriptors are moved into place by the new process right before it calls exec:
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  for (const auto& move : moves) posix_spawn_file_actions_adddup2(&actions, move.second, move.first);
+
+  // if this is a background process, put it in its own process group:
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  if (is_background) {
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+  }
+
+  // find the executable without searching $PATH again:
+  const char* path = resolve_cmd(launch.argv[0]);
+  int err = path ? 0 : ENOENT;
+
+  // while tracing, the process also holds an exec pipe (see trace_exec()):
+  int exec_pipe[2] = {-1, -1};
+  if (tracing && pipe2(exec_pipe, O_CLOEXEC) == -1) exec_pipe[0] = -1;
+
+  // start the process without copying our address space:
+  pid_t pid;
+  if (path) err = posix_spawn(&pid, path, &actions, &attr, launch.argv.data(), command_env(launch));
+
+  // the cached path may have gone stale (e.g. the program was moved), so look it up again:
+  if (err == ENOENT && path && access(path, X_OK) == -1 && path_cache.erase(launch.argv[0])) {
+    path = resolve_cmd(launch.argv[0]);
+    if (path) err = posix_spawn(&pid, path, &actions, &attr, launch.argv.data(), command_env(launch));
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  if (exec_pipe[0] >= 0) trace_exec(exec_pipe, path && !err ? pid : -1, launch.argv[0]);
+
+  // posix_spawn isn't usable here (e.g. blocked by a sandbox), so fall back to fork():
+  if (err == ENOSYS) return fork_stage(path, launch, moves, is_background);
+
+  // the command doesn't exist:
+  if (!path) {
+    print_error(3);
+    return -1;
+  }
+
+  // too many arguments for one exec (e.g. from a glob), so they're run in batches, or the
+  // user is pointed at 'batch':
+  if (err == E2BIG && autobatch && !batching) return fork_batches(launch, moves, is_background);
+  if (err == E2BIG) {
+    fprintf(stderr, "myShell: %s: %s (see 'batch')\n", launch.argv[0], strerror(err));
+    return -1;
+  }
+
+  // the exec failed:
+  if (err) {
+    print_error(1);
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  launch_stats.spawned++;
+  launch_stats.spawn_us += seconds_between(start, end) * 1e6;
+  return pid;
+}
+
+pid_t fork_stage(const char* path, const Launch& launch, const std::vector<std::pair<int, int>>& moves,
+                 bool is_background) {
+  // flush anything pending so the child doesn't print it a second time:
+  fflush(stdout);
+  int exec_pipe[2] = {-1, -1};
+  if (tracing && path && pipe2(exec_pipe, O_CLOEXEC) == -1) exec_pipe[0] = -1;
+
+  pid_t pid = fork();
+  if (pid < 0) print_error(0);
+  if (pid) {
+    if (exec_pipe[0] >= 0) trace_exec(exec_pipe, pid, launch.argv[0]);
+    return pid;
+  }
+
+  // if this is a background process:
+  if (is_background) setpgid(0, 0);
+
+  // connect the pipes and the redirections:
+  for (const auto& move : moves) dup2(move.second, move.first);
+  if (launch.limits) apply_limits(*launch.limits);
+  if (launch.placement) apply_placement(*launch.placement);
+  export_assigns(launch);
+
+  // builtins in the middle of a pipeline (or in the background) run in the child:
+  auto builtin = BUILTINS.find(launch.argv[0]);
+  if (builtin != BUILTINS.end()) {
+    int status = builtin->second(launch.argv.size() - 1, (char**) launch.argv.data());
+    fflush(stdout);
+    _exit(status);
+  }
+
+  // execute the command (saying when, while tracing):
+  struct timespec exec_start = trace_now();
+  bool traced = exec_pipe[1] >= 0 && write(exec_pipe[1], &exec_start, sizeof(exec_start)) == sizeof(exec_start);
+  execv(path, launch.argv.data());
+
+  // if we're still here, there has been an error in the execution and we need
+  // to kill the current process (a second time in the exec pipe says so):
+  if (traced) traced = write(exec_pipe[1], &exec_start, sizeof(exec_start)) == sizeof(exec_start);
+  print_error(1);
+  exit(-1);
+}
+
+/* ---------- PARSER ---------- */
+
+// the plan for a line, from the cache if the same line was compiled before (while the
+// aliases were the same). the least recently used plans are dropped beyond PLAN_CACHE_MAX:
+std::shared_ptr<const Plan> compile_line(std::string_view line) {
+  // traced as 'parse', with 1 for a line that was in the cache:
+  struct timespec start;
+  if (tracing) start = trace_now();
+  auto found = plan_cache.find(line);
+  if (found != plan_cache.end()) {
+    auto entry = found->second;
+    if (entry->second->alias_generation == alias_generation) {
+      plan_lru.splice(plan_lru.begin(), plan_lru, entry);
+      if (tracing) {
+        struct timespec now = trace_now();
+        trace_event("parse", start, &now, 0, 1, line);
+      }
+      return entry->second;
+    }
+    plan_cache.erase(found);
+    plan_lru.erase(entry);
+  }
+
+  auto plan = std::make_shared<Plan>();
+  parse_plan(line, *plan);
+  plan_lru.emplace_front(std::string(line), plan);
+  plan_cache[plan_lru.front().first] = plan_lru.begin();
+  if (plan_lru.size() > PLAN_CACHE_MAX) {
+    plan_cache.erase(plan_lru.back().first);
+    plan_lru.pop_back();
+  }
+  if (tracing) {
+    struct timespec now = trace_now();
+    trace_event("parse", start, &now, 0, 0, line);
+  }
+  return plan;
+}
+
+// compiles a line into plan (without the cache). a line with a syntax error gets a plan
+// that only reports it:
+void parse_plan(std::string_view line, Plan& plan) {
+  plan = Plan();
+  plan.alias_generation = alias_generation;
+  Parser p;
+  p.plan = &plan;
+  lex(line, 0, p.tokens);
+  p.tokens.push_back({TOKEN_END, std::string_view()});
+  parse_list(p);
+  if (!next_is(p, TOKEN_END)) syntax_error(p);
+  plan.steps.push_back({STEP_END});
+  if (p.failed) {
+    plan.steps.assign(1, {STEP_END});
+    plan.pipelines.clear();
+    plan.heredocs.clear();
+  }
+}
+
+// splits input into words and operators (which are only recognized outside of quotation
+// marks). words keep their quotation marks here, they're dropped by make_word():
+void lex(std::string_view input, int chain, std::vector<Token>& tokens) {
+  // the operators that start with '<', '>' or '&', longest first:
+  static const char* const REDIRECTIONS[] = {"<<<", "&>>", ">>", "<<", ">&", "<&", "&>", ">", "<"};
+  size_t i = 0, n = input.size();
+  while (true) {
+    while (i < n && (input[i] == ' ' || input[i] == '\t')) i++;
+    if (i == n) return;
+    Token token = {TOKEN_WORD, std::string_view(), -1, chain};
+
+    // a number right before a redirection is the descriptor it redirects ('2>' or '2>&1'):
+    size_t digits = i;
+    while (digits < n && isdigit((unsigned char) input[digits])) digits++;
+    if (digits > i && digits < n && (input[digits] == '<' || input[digits] == '>')) {
+      token.fd = atoi(std::string(input.substr(i, digits - i)).c_str());
+      i = digits;
+    }
+
+    size_t start = i;
+    char c = input[i];
+    if (c == '<' || c == '>' || (c == '&' && i + 1 < n && input[i+1] == '>' && token.fd < 0)) {
+      for (const char* op : REDIRECTIONS) {
+        size_t len = strlen(op);
+        if (input.compare(i, len, op)) continue;
+        token.type = TOKEN_REDIRECT;
+        token.text = input.substr(i, len);
+        i += len;
+        break;
+      }
+    }
+    else if (c == '|' || c == '&') {
+      bool twice = i + 1 < n && input[i+1] == c;
+      token.type = c == '|' ? (twice ? TOKEN_OR : TOKEN_PIPE) : (twice ? TOKEN_AND : TOKEN_AMP);
+      token.text = input.substr(i, twice ? 2 : 1);
+      i += token.text.size();
+
+      // '|@cpus' is a pipe whose next stage runs on those CPUs:
+      if (token.type == TOKEN_PIPE && i < n && input[i] == '@') {
+        while (i < n && !strchr(" \t|&;()<>", input[i])) i++;
+        token.text = input.substr(start, i - start);
+      }
+    }
+    else if (c == ';' || c == '(' || c == ')') {
+      token.type = c == ';' ? TOKEN_SEMI : c == '(' ? TOKEN_OPEN : TOKEN_CLOSE;
+      token.text = input.substr(i++, 1);
+    }
+    else {
+      // a word runs up to a space or an operator, and quoted text keeps its spaces:
+      while (i < n && (!input[i] || !strchr(" \t|&;()<>", input[i]))) {
+        if (input[i] == '\"') while (i + 1 < n && input[++i] != '\"');
+        i++;
+      }
+      token.text = input.substr(start, i - start);
+    }
+    tokens.push_back(token);
+  }
+}
+
+Word make_word(std::string_view text) {
+  Word word;
+  word.raw = text;
+  bool quoted = false;
+  for (char c : text) {
+    if (c == '\"') {
+      quoted = !quoted;
+      word.quoted = true;
+      continue;
+    }
+    word.expand |= c == '$';
+    word.wildcard |= !quoted && (c == '*' || c == '?' || c == '[');
+    word.literal += c;
+  }
+  return word;
+}
+
+bool next_is(const Parser& p, TokenType type) {
+  return p.tokens[p.pos].type == type;
+}
+
+bool is_word(const Token& token, std::string_view word) {
+  return token.type == TOKEN_WORD && token.text == word;
+}
+
+// whether the next token ends the command being parsed (a '}' does inside a 'par' group):
+bool command_ends(const Parser& p) {
+  const Token& token = p.tokens[p.pos];
+  if (token.type == TOKEN_WORD) return p.groups && token.text == "}";
+  return token.type != TOKEN_REDIRECT && token.type != TOKEN_OPEN;
+}
+
+void syntax_error(Parser& p) {
+  const Token& token = p.tokens[p.pos];
+  if (token.type == TOKEN_END) parse_error(p, "[myShell] error: syntax error at the end of the line.");
+  else parse_error(p, "[myShell] error: syntax error near '" + std::string(token.text) + "'.");
+}
+
+// only the first error of a line is reported:
+void parse_error(Parser& p, const std::string& message) {
+  if (!p.failed) p.plan->error = message;
+  p.failed = true;
+}
+
+// the text of tokens [from, to), for the job table:
+std::string token_text(const Parser& p, size_t from, size_t to) {
+  std::string text;
+  for (size_t i = from; i < to; i++) {
+    if (i > from) text += ' ';
+    if (p.tokens[i].fd >= 0) text += std::to_string(p.tokens[i].fd);
+    text += p.tokens[i].text;
+  }
+  return text;
+}
+
+// list: and_or ((';' | '&') and_or)*, up to the end of the line, a ')', the '}' of a
+// 'par' group or the 'do' / 'done' of a loop. an and_or followed by '&' is the body of a
+// STEP_ASYNC:
+void parse_list(Parser& p) {
+  Plan& plan = *p.plan;
+  while (!p.failed) {
+    while (next_is(p, TOKEN_SEMI)) p.pos++;
+    if (list_ends(p)) return;
+
+    size_t first = p.pos;
+    size_t at = plan.steps.size();
+    size_t first_pipeline = plan.pipelines.size();
+    parse_and_or(p);
+    if (p.failed) return;
+    if (next_is(p, TOKEN_AMP)) make_async(p, at, first_pipeline, first);
+    else if (!next_is(p, TOKEN_SEMI) && !list_ends(p)) syntax_error(p);
+  }
+}
+
+bool list_ends(const Parser& p) {
+  const Token& token = p.tokens[p.pos];
+  if (token.type == TOKEN_END || token.type == TOKEN_CLOSE) return true;
+  if (p.groups && is_word(token, "}")) return true;
+  return p.loops && (is_word(token, "do") || is_word(token, "done"));
+}
+
+// turns the steps parsed from step at (and the tokens from first) into the body of a '&',
+// which is the next token. the '&' is only seen after its body (which may hold whole
+// loops), so the body is moved one step along to make room for the STEP_ASYNC:
+void make_async(Parser& p, size_t at, size_t first_pipeline, size_t first) {
+  Plan& plan = *p.plan;
+  for (size_t i = at; i < plan.steps.size(); i++) {
+    Step& step = plan.steps[i];
+    if (step.next >= 0) step.next++;
+    if (step.op == STEP_AND || step.op == STEP_OR || step.op == STEP_WHILE || step.op == STEP_UNTIL) step.arg++;
+    for (int& member : step.members) member++;
+  }
+  for (size_t i = first_pipeline; i < plan.pipelines.size(); i++) {
+    for (CommandPlan& stage : plan.pipelines[i].stages) {
+      if (stage.subshell >= 0) stage.subshell++;
+    }
+  }
+  plan.steps.insert(plan.steps.begin() + at, {STEP_ASYNC});
+  plan.steps.push_back({STEP_END});
+  plan.steps[at].next = plan.steps.size();
+  plan.steps[at].texts.push_back(token_text(p, first, p.pos));
+  p.pos++; // the '&'
+}
+
+// and_or: item (('&&' | '||') item)*. each connector jumps to the next one (or to the end)
+// when the item before it decided the outcome:
+void parse_and_or(Parser& p) {
+  Plan& plan = *p.plan;
+  int connector = -1;
+  parse_item(p);
+  while (!p.failed && (next_is(p, TOKEN_AND) || next_is(p, TOKEN_OR))) {
+    if (connector >= 0) plan.steps[connector].arg = plan.steps.size();
+    connector = plan.steps.size();
+    plan.steps.push_back({next_is(p, TOKEN_AND) ? STEP_AND : STEP_OR});
+    plan.steps[connector].next = connector + 1;
+    p.pos++;
+    parse_item(p);
+  }
+  if (connector >= 0) plan.steps[connector].arg = plan.steps.size();
+}
+
+// item: 'time' item | 'memo' [-i file | -e var | --stats]... pipeline |
+//       'limit' key=value... pipeline | 'par' [-j N] '{' list '}' |
+//       '@'host[,host]... pipeline | 'pin' (cpus | 'auto') ['mem='nodes] pipeline | pipeline
+// the keywords are recognized before aliases, and their own command may be left out
+// (which they report when run, like their usage):
+void parse_item(Parser& p) {
+  Plan& plan = *p.plan;
+  const Token& token = p.tokens[p.pos];
+  StepOp op;
+  if (is_word(token, "time")) op = STEP_TIME;
+  else if (is_word(token, "memo")) op = STEP_MEMO;
+  else if (is_word(token, "limit")) op = STEP_LIMIT;
+  else if (is_word(token, "par")) op = STEP_PAR;
+  else if (is_word(token, "pin")) op = STEP_PIN;
+  else if (token.type == TOKEN_WORD && token.text.size() > 1 && token.text[0] == '@') op = STEP_REMOTE;
+  else {
+    parse_pipeline(p);
+    return;
+  }
+  size_t at = plan.steps.size();
+  plan.steps.push_back({op});
+  p.pos++;
+
+  if (op == STEP_TIME) {
+    if (!command_ends(p)) parse_item(p);
+  }
+  else if (op == STEP_MEMO) {
+    // every '-' word is an option (so run_memo() can reject the ones it doesn't know):
+    while (next_is(p, TOKEN_WORD) && p.tokens[p.pos].text[0] == '-') {
+      bool has_arg = is_word(p.tokens[p.pos], "-i") || is_word(p.tokens[p.pos], "-e");
+      plan.steps[at].args.push_back(make_word(p.tokens[p.pos++].text));
+      if (has_arg && !next_is(p, TOKEN_WORD)) return syntax_error(p);
+      if (has_arg) plan.steps[at].args.push_back(make_word(p.tokens[p.pos++].text));
+    }
+    if (!command_ends(p)) parse_pipeline(p);
+  }
+  else if (op == STEP_LIMIT) {
+    while (next_is(p, TOKEN_WORD) && is_assignment(p.tokens[p.pos].text)) {
+      plan.steps[at].args.push_back(make_word(p.tokens[p.pos++].text));
+    }
+    if (!command_ends(p)) parse_pipeline(p);
+  }
+  else if (op == STEP_PIN) {
+    if (!command_ends(p)) plan.steps[at].args.push_back(make_word(p.tokens[p.pos++].text));
+    while (next_is(p, TOKEN_WORD) && p.tokens[p.pos].text.substr(0, 4) == "mem=") {
+      plan.steps[at].args.push_back(make_word(p.tokens[p.pos++].text));
+    }
+    if (!command_ends(p)) parse_pipeline(p);
+  }
+  else if (op == STEP_REMOTE) {
+    plan.steps[at].args.push_back(make_word(token.text.substr(1)));
+    if (!command_ends(p)) parse_pipeline(p);
+  }
+  else parse_group(p, at);
+  plan.steps[at].next = plan.steps.size();
+}
+
+// loop: 'for' NAME 'in' word... [';'] body | ('while' | 'until') list body |
+//       'repeat' N command
+// (the command of 'repeat' is just the one, so 'repeat 3 cmd | sort' sorts all three runs):
+void parse_loop(Parser& p) {
+  Plan& plan = *p.plan;
+  const Token& token = p.tokens[p.pos];
+  StepOp op = is_word(token, "for") ? STEP_FOR : is_word(token, "while") ? STEP_WHILE :
+              is_word(token, "until") ? STEP_UNTIL : STEP_REPEAT;
+  size_t at = plan.steps.size();
+  plan.steps.push_back({op});
+  p.pos++;
+  if (op == STEP_FOR) parse_for(p, at);
+  else if (op == STEP_WHILE || op == STEP_UNTIL) parse_while(p, at);
+  else {
+    if (!command_ends(p)) plan.steps[at].args.push_back(make_word(p.tokens[p.pos++].text));
+    if (!command_ends(p)) parse_pipeline(p, true);
+  }
+  plan.steps[at].next = plan.steps.size();
+}
+
+// the variable and words of a 'for' (whose step is at), and then its body:
+void parse_for(Parser& p, size_t at) {
+  Plan& plan = *p.plan;
+  if (!next_is(p, TOKEN_WORD) || !valid_name(p.tokens[p.pos].text)) return syntax_error(p);
+  plan.steps[at].name = p.tokens[p.pos++].text;
+  if (!is_word(p.tokens[p.pos], "in")) return syntax_error(p);
+  p.pos++;
+  while (next_is(p, TOKEN_WORD)) plan.steps[at].args.push_back(make_word(p.tokens[p.pos++].text));
+  if (next_is(p, TOKEN_SEMI)) p.pos++;
+  parse_body(p);
+}
+
+// the condition of a 'while' or 'until' (whose step is at), and then its body:
+void parse_while(Parser& p, size_t at) {
+  Plan& plan = *p.plan;
+  p.loops++;
+  parse_list(p);
+  p.loops--;
+  plan.steps.push_back({STEP_END});
+  plan.steps[at].arg = plan.steps.size();
+  if (!p.failed) parse_body(p);
+}
+
+// body: 'do' list 'done'
+void parse_body(Parser& p) {
+  Plan& plan = *p.plan;
+  if (!is_word(p.tokens[p.pos], "do")) return syntax_error(p);
+  p.pos++;
+  p.loops++;
+  parse_list(p);
+  p.loops--;
+  plan.steps.push_back({STEP_END});
+  if (p.failed) return;
+  if (!is_word(p.tokens[p.pos], "done")) return syntax_error(p);
+  p.pos++;
+}
+
+// the options and members of a 'par' group, whose step is at. every member is a list of
+// its own, separated by ';' or '&':
+void parse_group(Parser& p, size_t at) {
+  Plan& plan = *p.plan;
+  const char* usage = "[par] error: usage: par [-j N] { cmd ; cmd ; ... }";
+  while (next_is(p, TOKEN_WORD) && !is_word(p.tokens[p.pos], "{")) {
+    plan.steps[at].args.push_back(make_word(p.tokens[p.pos++].text));
+  }
+  if (!is_word(p.tokens[p.pos], "{")) return parse_error(p, usage);
+  p.pos++;
+  p.groups++;
+  while (!p.failed) {
+    while (next_is(p, TOKEN_SEMI) || next_is(p, TOKEN_AMP)) p.pos++;
+    if (is_word(p.tokens[p.pos], "}")) break;
+    if (next_is(p, TOKEN_END)) return parse_error(p, usage);
+    size_t first = p.pos;
+    plan.steps[at].members.push_back(plan.steps.size());
+    parse_and_or(p);
+    plan.steps.push_back({STEP_END});
+    plan.steps[at].texts.push_back(token_text(p, first, p.pos));
+    if (!p.failed && !next_is(p, TOKEN_SEMI) && !next_is(p, TOKEN_AMP) && !is_word(p.tokens[p.pos], "}")) {
+      syntax_error(p);
+    }
+  }
+  p.groups--;
+  if (!p.failed) p.pos++; // the '}'
+}
+
+// pipeline: command (('|' | '|@'cpus) command)*, or just the first command if single
+void parse_pipeline(Parser& p, bool single) {
+  Plan& plan = *p.plan;
+  int index = plan.pipelines.size();
+  plan.pipelines.emplace_back();
+  size_t at = plan.steps.size();
+  plan.steps.push_back({STEP_PIPELINE, index});
+  size_t first = p.pos;
+  std::string_view cpus; // from the '|@cpus' before the stage
+  while (!p.failed) {
+    CommandPlan command; // subshells add pipelines of their own, so this is moved in after
+    command.cpus = make_word(cpus);
+    parse_command(p, command);
+    plan.pipelines[index].stages.push_back(std::move(command));
+    if (single || !next_is(p, TOKEN_PIPE)) break;
+    if (p.tokens[p.pos].text == "|@") return syntax_error(p);
+    cpus = p.tokens[p.pos].text.substr(std::min<size_t>(2, p.tokens[p.pos].text.size()));
+    p.pos++;
+  }
+  plan.pipelines[index].text = token_text(p, first, p.pos);
+  plan.steps[at].next = plan.steps.size();
+}
+
+// command: '(' list ')' redirection* | loop redirection* | (word | redirection)+ (after
+// expanding aliases)
+void parse_command(Parser& p, CommandPlan& command) {
+  Plan& plan = *p.plan;
+  size_t first = p.pos;
+  const Token& token = p.tokens[p.pos];
+  if (is_word(token, "for") || is_word(token, "while") || is_word(token, "until") || is_word(token, "repeat")) {
+    // a loop is a list of its own, like a subshell's:
+    command.subshell = plan.steps.size();
+    command.loop = true;
+    parse_loop(p);
+    plan.steps.push_back({STEP_END});
+    while (!p.failed && next_is(p, TOKEN_REDIRECT)) parse_redirect(p, command);
+  }
+  else if (next_is(p, TOKEN_OPEN)) {
+    p.pos++;
+    command.subshell = plan.steps.size();
+    int groups = p.groups, loops = p.loops; // a '}' or 'done' inside the parentheses is just a word
+    p.groups = 0;
+    p.loops = 0;
+    parse_list(p);
+    p.groups = groups;
+    p.loops = loops;
+    plan.steps.push_back({STEP_END});
+    if (!next_is(p, TOKEN_CLOSE)) return syntax_error(p);
+    p.pos++;
+    while (next_is(p, TOKEN_REDIRECT)) parse_redirect(p, command);
+  }
+  else {
+    expand_alias(p);
+    while (!p.failed && !command_ends(p)) {
+      if (next_is(p, TOKEN_OPEN)) return syntax_error(p);
+      if (next_is(p, TOKEN_REDIRECT)) parse_redirect(p, command);
+      else command.words.push_back(make_word(p.tokens[p.pos++].text));
+    }
+    if (command.words.empty() && command.redirects.empty()) return syntax_error(p);
+    // leading 'NAME=value' words are assignments: to the shell's variables if that's all
+    // there is, or else to the command's environment (and never globs):
+    size_t assigns = 0;
+    while (assigns < command.words.size() && is_assignment(command.words[assigns].raw)) {
+      command.words[assigns++].wildcard = false;
+    }
+    command.assignments = assigns && assigns == command.words.size();
+    if (!command.assignments) command.env_words = assigns;
+  }
+  command.text = token_text(p, first, p.pos);
+}
+
+// redirection: [N]('>' | '>>' | '<' | '>&' | '<&' | '<<<' | '<<') word, or ('&>' | '&>>') word.
+// '&> file' and '>& file' send both STDOUT and STDERR to the file:
+void parse_redirect(Parser& p, CommandPlan& command) {
+  Plan& plan = *p.plan;
+  Token op = p.tokens[p.pos++];
+  if (!next_is(p, TOKEN_WORD)) return syntax_error(p);
+  size_t word = p.pos; // where errors about the target are reported
+  RedirectPlan redirect;
+  redirect.target = make_word(p.tokens[p.pos++].text);
+  std::string_view text = op.text;
+  redirect.fd = op.fd >= 0 ? op.fd : text[0] == '<' ? STDIN_FILENO : STDOUT_FILENO;
+
+  const std::string& target = redirect.target.literal;
+  bool number = !target.empty() && !redirect.target.expand &&
+                target.find_first_not_of("0123456789") == std::string::npos;
+  if (text == "<<<") redirect.kind = REDIRECT_HERE_STRING;
+  else if (text == "<<") {
+    redirect.kind = REDIRECT_HERE_DOC;
+    redirect.heredoc = plan.heredocs.size();
+    plan.heredocs.push_back(target);
+  }
+  else if ((text == ">&" || text == "<&") && number) redirect.kind = REDIRECT_COPY;
+  else if (text == "<&") {
+    p.pos = word;
+    return syntax_error(p);
+  }
+  else if (text == "<") redirect.flags = O_RDONLY;
+  else redirect.flags = (text == ">>" || text == "&>>") ? FILEFLAGS_APPEND : FILEFLAGS;
+
+  bool both = text[0] == '&' || (text == ">&" && redirect.kind == REDIRECT_FILE);
+  if (both && op.fd >= 0) {
+    p.pos = word;
+    return syntax_error(p);
+  }
+  command.redirects.push_back(redirect);
+  if (both) {
+    RedirectPlan copy;
+    copy.kind = REDIRECT_COPY;
+    copy.fd = STDERR_FILENO;
+    copy.target = make_word("1");
+    command.redirects.push_back(copy);
+  }
+}
+
+// replaces the command's first word with its alias, and the first word of that with its
+// own alias, and so on. a value can hold a pipeline (or a whole list) of its own, whose
+// commands are expanded as they're parsed. a name isn't expanded again inside its own
+// expansion (so 'alias ls="ls -F"' works), and chains end after ALIAS_DEPTH_MAX:
+void expand_alias(Parser& p) {
+  while (alias_count && next_is(p, TOKEN_WORD)) {
+    const Token& token = p.tokens[p.pos];
+    std::string name(token.text);
+    const std::string* value = name.find_first_of("\"$") == std::string::npos ? alias_find(name) : NULL;
+    std::vector<std::string> used = p.chains[token.chain];
+    if (!value || std::find(used.begin(), used.end(), name) != used.end()) return;
+    if (used.size() == ALIAS_DEPTH_MAX) return parse_error(p, "[alias] error: " + name + ": expanded too many times.");
+
+    used.push_back(name);
+    p.chains.push_back(std::move(used));
+    std::vector<Token> expansion;
+    lex(*value, p.chains.size() - 1, expansion);
+    p.tokens.erase(p.tokens.begin() + p.pos);
+    p.tokens.insert(p.tokens.begin() + p.pos, expansion.begin(), expansion.end());
+  }
+}
+
+/* ---------- INPUT ---------- */
+
+void open_reader(LineReader& reader, int fd) {
+  reader.fd = fd;
+  reader.buf.resize(READ_CHUNK);
+  reader.data = reader.buf.data();
+  reader.len = 0;
+}
+
+bool open_script(LineReader& reader, const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+
+  // map the whole script instead of reading it (an empty file has nothing to map):
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return false;
+  }
+  if (st.st_size > 0) {
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // not mappable (e.g. a pipe given as /dev/stdin), so read it instead:
+    if (map == MAP_FAILED) {
+      open_reader(reader, fd);
+      return true;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    reader.data = (const char*) map;
+    reader.len = st.st_size;
+  }
+  close(fd);
+  reader.fd = -1;
+  return true;
+}
+
+void open_string(LineReader& reader, const char* str) {
+  reader.fd = -1;
+  reader.data = str;
+  reader.len = strlen(str);
+}
+
+bool read_line(LineReader& reader, std::string& line) {
+  while (1) {
+    // return the next complete line, if we have one:
+    const char* newline = (const char*) memchr(reader.data, '\n', reader.len);
+    if (newline) {
+      line.assign(reader.data, newline - reader.data);
+      reader.len -= newline + 1 - reader.data;
+      reader.data = newline + 1;
+      return true;
+    }
+
+    // memory input has no more lines, but the last one may lack its newline:
+    if (reader.fd < 0) break;
+
+    // move the partial line to the front of the buffer (growing it for very long lines):
+    memmove(reader.buf.data(), reader.data, reader.len);
+    if (reader.buf.size() - reader.len < READ_CHUNK) reader.buf.resize(reader.buf.size() * 2);
+    reader.data = reader.buf.data();
+
+    ssize_t n = read(reader.fd, reader.buf.data() + reader.len, reader.buf.size() - reader.len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    reader.len += n;
+  }
+
+  // end of the input:
+  if (reader.len == 0) return false;
+  line.assign(reader.data, reader.len);
+  reader.len = 0;
+  return true;
+}
+
+// reads a line with the line editor on a terminal (which prints the prompt), and with
+// read_line() otherwise:
+bool next_line(LineReader& reader, const char* prompt, std::string& line) {
+  fflush(stdout);
+  return interactive ? edit_line(prompt, line) : read_line(reader, line);
+}
+
+// reads the body of every '<<WORD' of the line, which is the lines that follow up to one
+// that is just WORD:
+void read_heredocs(LineReader& reader, const Plan& plan) {
+  heredocs.clear();
+  for (const std::string& word : plan.heredocs) {
+    std::string body, line;
+    while (next_line(reader, "> ", line) && line != word) {
+      body += line;
+      body += '\n';
+    }
+    heredocs.push_back(std::move(body));
+  }
+}
+
+/* ---------- HISTORY ---------- */
+
+// opens $HISTFILE (or ~/.myshell_history), creating it if needed:
+bool history_open() {
+  if (history.fd >= 0) return true;
+  std::string path;
+  if (getenv("HISTFILE") && *getenv("HISTFILE")) path = getenv("HISTFILE");
+  else if (getenv("HOME")) path = std::string(getenv("HOME")) + "/.myshell_history";
+  else return false;
+  history.fd = open(path.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  return history.fd >= 0 && history_sync();
+}
+
+// maps whatever was appended since the last call, and indexes the new entries:
+bool history_sync() {
+  struct stat st;
+  if (history.fd < 0 || fstat(history.fd, &st) == -1) return false;
+  size_t len = st.st_size;
+  if (len != history.len) {
+    if (history.data) munmap((void*) history.data, history.len);
+    history.data = NULL;
+    history.len = 0;
+    if (len) {
+      void* data = mmap(NULL, len, PROT_READ, MAP_SHARED, history.fd, 0);
+      if (data == MAP_FAILED) return false;
+      history.data = (const char*) data;
+      history.len = len;
+    }
+    // a file that shrank was rewritten by someone else, so the index starts over:
+    if (len < history.indexed) {
+      history.ends.clear();
+      history.indexed = 0;
+    }
+  }
+  return true;
+}
+
+// the index only covers complete entries, so a half-written one is picked up later:
+void history_index() {
+  if (history.ends.empty() && !history.indexed) history.ends.reserve(history.len / 32);
+  const char* data = history.data;
+  while (history.indexed < history.len) {
+    const char* nl = (const char*) memchr(data + history.indexed, '\n', history.len - history.indexed);
+    if (!nl) break;
+    history.ends.push_back(nl - data);
+    history.indexed = nl - data + 1;
+  }
+}
+
+// appends one entry. the lock keeps sessions from interleaving entries bigger than what
+// the kernel writes atomically:
+void history_add(std::string_view line) {
+  while (!line.empty() && (line[0] == ' ' || line[0] == '\t')) line.remove_prefix(1);
+  while (!line.empty() && (line.back() == ' ' || line.back() == '\t')) line.remove_suffix(1);
+  if (line.empty() || history.fd < 0) return;
+  std::string entry(line);
+  for (char& c : entry) if (c == '\n') c = ' ';
+  entry += '\n';
+  flock(history.fd, LOCK_EX);
+  for (size_t done = 0; done < entry.size();) {
+    ssize_t n = write(history.fd, entry.data() + done, entry.size() - done);
+    if (n <= 0) break;
+    done += n;
+  }
+  flock(history.fd, LOCK_UN);
+}
+
+std::string_view history_entry(size_t i) {
+  size_t start = i ? history.ends[i-1] + 1 : 0;
+  return std::string_view(history.data + start, history.ends[i] - start);
+}
+
+// the latest entry before entry 'before' that starts with (or contains) the needle, or
+// -1. substrings are found with memmem() over the whole mapping, then located in the index:
+long history_search(std::string_view needle, size_t before, bool prefix) {
+  history_sync();
+  history_index();
+  before = std::min(before, history.ends.size());
+  if (prefix) {
+    for (size_t i = before; i-- > 0;) {
+      if (!history_entry(i).compare(0, needle.size(), needle)) return i;
+    }
+    return -1;
+  }
+
+  // search forward from the start, keeping the last match before the limit:
+  size_t limit = before ? history.ends[before-1] : 0;
+  long found = -1;
+  const char* data = history.data;
+  for (size_t pos = 0; pos < limit;) {
+    const char* match = (const char*) memmem(data + pos, limit - pos, needle.data(), needle.size());
+    if (!match) break;
+    size_t entry = std::upper_bound(history.ends.begin(), history.ends.begin() + before, match - data) - history.ends.begin();
+    if (entry >= before) break;
+    found = entry;
+    pos = history.ends[entry] + 1; // look for the next match in a later entry
+  }
+  return found;
+}
+
+// 'history [n]' lists the last n entries, 'history -s text' those containing the text,
+// and 'history -p text' those starting with it:
+int handle_history(int argc, char** argv) {
+  if (!history_open()) {
+    fprintf(stderr, "[history] error: no history file.\n");
+    return 1;
+  }
+  history_sync();
+  history_index();
+  size_t count = history.ends.size();
+
+  if (argc == 3 && (!strcmp(argv[1], "-s") || !strcmp(argv[1], "-p"))) {
+    bool prefix = argv[1][1] == 'p';
+    std::string_view needle = argv[2];
+
+    // unlike history_search() this goes through every entry once, oldest first:
+    bool found = false;
+    for (size_t i = 0; i < count; i++) {
+      std::string_view entry = history_entry(i);
+      size_t at = prefix ? entry.compare(0, needle.size(), needle) : entry.find(needle);
+      if (prefix ? at != 0 : at == std::string_view::npos) continue;
+      printf("%5zu  %.*s\n", i + 1, (int) entry.size(), entry.data());
+      found = true;
+    }
+    return !found;
+  }
+
+  size_t first = 0;
+  if (argc >= 2) {
+    char* end;
+    long n = strtol(argv[1], &end, 10);
+    if (argc > 2 || *end || n < 0) {
+      fprintf(stderr, "[history] error: usage: history [n | -s text | -p text]\n");
+      return 1;
+    }
+    if ((size_t) n < count) first = count - n;
+  }
+  for (size_t i = first; i < count; i++) {
+    std::string_view entry = history_entry(i);
+    printf("%5zu  %.*s\n", i + 1, (int) entry.size(), entry.data());
+  }
+  return 0;
+}
+
+/* ---------- LINE EDITOR ---------- */
+
+// keys that arrive as escape sequences, numbered past every byte:
+// (CTRL('x') is the byte sent for CTRL+X, from termios.h)
+enum { KEY_UP = 256, KEY_DOWN, KEY_LEFT, KEY_RIGHT, KEY_HOME, KEY_END, KEY_DELETE, KEY_NONE };
+
+// reads a line from the terminal with the cursor keys, history recall (up, down and
+// CTRL+R) and tab completion. false at the end of the input (CTRL+D on an empty line):
+bool edit_line(const char* prompt, std::string& line) {
+  struct termios orig, raw;
+  if (tcgetattr(STDIN_FILENO, &orig) == -1) {
+    // not a terminal after all, so just read it:
+    write_str("");
+    LineReader reader;
+    open_reader(reader, STDIN_FILENO);
+    return read_line(reader, line);
+  }
+
+  // read every key as it's pressed, drawing the line ourselves. output processing stays
+  // on, and the terminal is restored before anything runs:
+  raw = orig;
+  raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+  raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+
+  line.clear();
+  size_t cursor = 0;
+  std::string saved; // the line being typed, while browsing the history
+  size_t recalled = SIZE_MAX; // the history entry shown, SIZE_MAX for the typed line
+  int last_key = 0;
+  bool done = false, eof = false;
+  redraw_line(prompt, line, cursor);
+
+  while (!done) {
+    int key = read_key();
+    switch (key) {
+      case -1: // the terminal went away
+      case CTRL('d'):
+        if (key == CTRL('d') && !line.empty()) {
+          if (cursor < line.size()) line.erase(cursor, char_len(line, cursor));
+          break;
+        }
+        eof = true;
+        done = true;
+        break;
+      case '\r':
+      case '\n':
+        done = true;
+        break;
+      case CTRL('c'):
+        write_str("^C\r\n");
+        line.clear();
+        cursor = 0;
+        recalled = SIZE_MAX;
+        break;
+      case 127:
+      case CTRL('h'):
+        if (cursor > 0) {
+          size_t start = prev_char(line, cursor);
+          line.erase(start, cursor - start);
+          cursor = start;
+        }
+        break;
+      case KEY_DELETE:
+        if (cursor < line.size()) line.erase(cursor, char_len(line, cursor));
+        break;
+      case KEY_LEFT:
+      case CTRL('b'):
+        if (cursor > 0) cursor = prev_char(line, cursor);
+        break;
+      case KEY_RIGHT:
+      case CTRL('f'):
+        if (cursor < line.size()) cursor += char_len(line, cursor);
+        break;
+      case KEY_HOME:
+      case CTRL('a'):
+        cursor = 0;
+        break;
+      case KEY_END:
+      case CTRL('e'):
+        cursor = line.size();
+        break;
+      case CTRL('k'):
+        line.erase(cursor);
+        break;
+      case CTRL('u'):
+        line.erase(0, cursor);
+        cursor = 0;
+        break;
+      case CTRL('w'): {
+        size_t start = cursor;
+        while (start > 0 && line[start-1] == ' ') start--;
+        while (start > 0 && line[start-1] != ' ') start--;
+        line.erase(start, cursor - start);
+        cursor = start;
+        break;
+      }
+      case CTRL('l'):
+        write_str("\x1b[H\x1b[2J");
+        break;
+      case KEY_UP:
+      case KEY_DOWN: {
+        // step through the history, keeping what was typed for when we come back:
+        if (!history_sync()) break;
+        history_index();
+        size_t count = history.ends.size();
+        if (recalled == SIZE_MAX) recalled = count;
+        if (key == KEY_UP && recalled == 0) break;
+        if (key == KEY_DOWN && recalled >= count) break;
+        if (recalled == count) saved = line;
+        recalled += key == KEY_UP ? -1 : 1;
+        line = recalled < count ? std::string(history_entry(recalled)) : saved;
+        if (recalled == count) recalled = SIZE_MAX;
+        cursor = line.size();
+        break;
+      }
+      case CTRL('r'):
+        done = reverse_search(line, cursor);
+        break;
+      case '\t':
+        complete_word(line, cursor, last_key == '\t');
+        break;
+      default:
+        if (key >= ' ' && key < 256) {
+          line.insert(cursor++, 1, (char) key);
+          recalled = SIZE_MAX;
+        }
+    }
+    last_key = key;
+    if (!done) redraw_line(prompt, line, cursor);
+  }
+
+  write_str("\r\n");
+  tcsetattr(STDIN_FILENO, TCSADRAIN, &orig);
+  return !eof;
+}
+
+// the next key pressed, with escape sequences turned into KEY_*. input is read in blocks,
+// so a pasted line doesn't cost a read() per byte:
+int read_key() {
+  static unsigned char buf[256];
+  static ssize_t pos = 0, len = 0;
+  auto next = [&]() -> int {
+    while (pos == len) {
+      len = read(STDIN_FILENO, buf, sizeof(buf));
+      pos = 0;
+      if (len < 0 && errno == EINTR) len = 0;
+      else if (len <= 0) {
+        len = 0;
+        return -1;
+      }
+    }
+    return buf[pos++];
+  };
+
+  int c = next();
+  if (c != '\x1b') return c;
+  int kind = next();
+  if (kind != '[' && kind != 'O') return KEY_NONE;
+  c = next();
+  switch (c) {
+    case 'A': return KEY_UP;
+    case 'B': return KEY_DOWN;
+    case 'C': return KEY_RIGHT;
+    case 'D': return KEY_LEFT;
+    case 'H': return KEY_HOME;
+    case 'F': return KEY_END;
+  }
+
+  // 'ESC [ n ~' sequences:
+  int n = 0;
+  while (c >= '0' && c <= '9') {
+    n = n * 10 + c - '0';
+    c = next();
+  }
+  if (c != '~') return KEY_NONE;
+  if (n == 1 || n == 7) return KEY_HOME;
+  if (n == 4 || n == 8) return KEY_END;
+  if (n == 3) return KEY_DELETE;
+  return KEY_NONE;
+}
+
+// the cursor moves by whole UTF-8 characters:
+size_t char_len(const std::string& line, size_t i) {
+  size_t end = i + 1;
+  while (end < line.size() && (line[end] & 0xc0) == 0x80) end++;
+  return end - i;
+}
+
+size_t prev_char(const std::string& line, size_t i) {
+  do i--;
+  while (i > 0 && (line[i] & 0xc0) == 0x80);
+  return i;
+}
+
+// everything the shell draws on the terminal goes through here. stdio's buffer is flushed
+// first (so nothing comes out of order), and the text goes out with what's waiting in
+// terminal_out in a single writev():
+void write_str(const std::string& text) {
+  fflush(stdout);
+  struct iovec parts[2] = {{terminal_out.data(), terminal_out.size()}, {(void*) text.data(), text.size()}};
+  int first = 0;
+  for (size_t left = terminal_out.size() + text.size(); left;) {
+    ssize_t n = writev(STDOUT_FILENO, parts + first, 2 - first);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    left -= n;
+    for (; first < 2 && (size_t) n >= parts[first].iov_len; first++) n -= parts[first].iov_len;
+    if (first < 2) {
+      parts[first].iov_base = (char*) parts[first].iov_base + n;
+      parts[first].iov_len -= n;
+    }
+  }
+  terminal_out.clear();
+}
+
+// adds to what's written along with the next prompt:
+void out_printf(const char* format, ...) {
+  va_list args, copy;
+  va_start(args, format);
+  va_copy(copy, args);
+  int size = vsnprintf(NULL, 0, format, copy);
+  va_end(copy);
+  if (size > 0) {
+    size_t at = terminal_out.size();
+    terminal_out.resize(at + size + 1);
+    vsnprintf(&terminal_out[at], size + 1, format, args);
+    terminal_out.resize(at + size);
+  }
+  va_end(args);
+}
+
+// redraws the prompt and line with a single write, leaving the cursor in place:
+void redraw_line(const char* prompt, const std::string& line, size_t cursor) {
+  std::string out = "\r";
+  out += prompt;
+  out += line;
+  out += "\x1b[K";
+  size_t back = 0;
+  for (size_t i = cursor; i < line.size(); i++) back += (line[i] & 0xc0) != 0x80;
+  if (back) out += "\x1b[" + std::to_string(back) + "D";
+  write_str(out);
+}
+
+// CTRL+R: every key typed narrows the search, CTRL+R again finds an older match. enter
+// runs the match (returning true), other keys accept it for editing, CTRL+G cancels:
+bool reverse_search(std::string& line, size_t& cursor) {
+  if (!history_sync()) return false;
+  history_index();
+  std::string query;
+  size_t count = history.ends.size();
+  long match = -1;
+  std::string found = line;
+  bool failed = false;
+  while (true) {
+    std::string out = failed ? "\r(failed reverse-i-search)`" : "\r(reverse-i-search)`";
+    out += query + "': " + found + "\x1b[K";
+    write_str(out);
+
+    int key = read_key();
+    if (key == CTRL('r')) {
+      long older = query.empty() ? -1 : history_search(query, match >= 0 ? match : count, false);
+      if (older >= 0) match = older;
+      failed = !query.empty() && older < 0;
+    }
+    else if (key == 127 || key == CTRL('h') || (key >= ' ' && key < 256)) {
+      // a longer query may still match the current entry, so search from just after it:
+      if (key == 127 || key == CTRL('h')) {
+        if (!query.empty()) query.pop_back();
+      }
+      else query += (char) key;
+      match = query.empty() ? -1 : history_search(query, match >= 0 ? match + 1 : count, false);
+      failed = !query.empty() && match < 0;
+    }
+    else {
+      if (key == CTRL('g') || key == CTRL('c')) return false;
+      line = found;
+      cursor = line.size();
+      return key == '\r' || key == '\n';
+    }
+    if (match >= 0) found = history_entry(match);
+  }
+}
+
+// completes the word before the cursor: a command name if it's the first word of a
+// stage, and a path otherwise. a second tab lists the choices if there's more than one:
+void complete_word(std::string& line, size_t& cursor, bool list) {
+  size_t start = cursor;
+  while (start > 0 && !strchr(" \t|;&<>", line[start-1])) start--;
+  size_t before = start;
+  while (before > 0 && line[before-1] == ' ') before--;
+  bool command = (before == 0 || strchr("|;&{", line[before-1])) && line.find('/', start) >= cursor;
+  std::string word = line.substr(start, cursor - start);
+
+  std::vector<std::string> choices;
+  if (command) command_choices(word, choices);
+  else path_choices(word, choices);
+  if (choices.empty()) return;
+
+  // add what every choice has in common:
+  std::string common = choices[0];
+  for (const std::string& choice : choices) {
+    size_t n = 0;
+    while (n < common.size() && n < choice.size() && common[n] == choice[n]) n++;
+    common.resize(n);
+  }
+  if (choices.size() == 1 && common.back() != '/') common += ' ';
+  if (common.size() > word.size()) {
+    line.replace(start, cursor - start, common);
+    cursor = start + common.size();
+    return;
+  }
+  if (!list || choices.size() == 1) return;
+
+  // print the choices below the line, which is redrawn after them:
+  std::string out = "\r\n";
+  for (const std::string& choice : choices) {
+    size_t slash = choice.rfind('/', choice.size() - 2);
+    out += choice.substr(slash == std::string::npos ? 0 : slash + 1) + "  ";
+  }
+  out += "\r\n";
+  write_str(out);
+}
+
+// builtins, remembered commands and everything in $PATH starting with prefix:
+void command_choices(const std::string& prefix, std::vector<std::string>& choices) {
+  alias_choices(prefix, choices);
+  for (const auto& builtin : BUILTINS) {
+    if (!builtin.first.compare(0, prefix.size(), prefix)) choices.push_back(builtin.first);
+  }
+  for (const auto& entry : path_cache) {
+    if (!entry.first.compare(0, prefix.size(), prefix)) choices.push_back(entry.first);
+  }
+  const char* search_path = getenv("PATH");
+  std::string_view dirs = search_path ? search_path : "/usr/bin:/bin";
+  while (!dirs.empty()) {
+    size_t colon = std::min(dirs.find(':'), dirs.size());
+    std::string dir(dirs.substr(0, colon));
+    dirs.remove_prefix(std::min(colon + 1, dirs.size()));
+    const DirListing& listing = list_dir(dir.empty() ? "." : dir);
+    auto it = std::lower_bound(listing.names.begin(), listing.names.end(), prefix);
+    for (size_t i = it - listing.names.begin(); i < listing.names.size(); i++) {
+      if (listing.names[i].compare(0, prefix.size(), prefix)) break;
+      if (!listing.dirs[i]) choices.push_back(listing.names[i]);
+    }
+  }
+  std::sort(choices.begin(), choices.end());
+  choices.erase(std::unique(choices.begin(), choices.end()), choices.end());
+}
+
+// the entries of a directory starting with the last part of word, as whole words (with a
+// trailing '/' for directories). hidden entries only show up when asked for by name:
+void path_choices(const std::string& word, std::vector<std::string>& choices) {
+  size_t slash = word.rfind('/');
+  std::string dir = slash == std::string::npos ? "." : word.substr(0, slash + 1);
+  std::string lead = slash == std::string::npos ? "" : dir;
+  std::string prefix = word.substr(slash == std::string::npos ? 0 : slash + 1);
+  if (!dir.compare(0, 2, "~/") && getenv("HOME")) dir = getenv("HOME") + dir.substr(1);
+
+  const DirListing& listing = list_dir(dir);
+  auto it = std::lower_bound(listing.names.begin(), listing.names.end(), prefix);
+  for (size_t i = it - listing.names.begin(); i < listing.names.size(); i++) {
+    const std::string& name = listing.names[i];
+    if (name.compare(0, prefix.size(), prefix)) break;
+    if (name[0] == '.' && prefix.empty()) continue;
+    choices.push_back(lead + name + (listing.dirs[i] ? "/" : ""));
+  }
+}
+
+/* ---------- GLOBS ---------- */
+
+// expands every unquoted argument with a '*', '?' or '[' into the paths it matches (in
+// order). arguments matching nothing are passed on as they are, like in other shells:
+void expand_globs(Launch& launch) {
+  std::vector<std::string>& matches = launch.matches;
+  matches.clear();
+  int argc = launch.argv.size() - 1;
+  std::vector<size_t> ends(launch.glob_args.size()); // where each argument's matches end
+  for (size_t g = 0; g < launch.glob_args.size(); g++) {
+    if (launch.glob_args[g] < argc) glob(launch.argv[launch.glob_args[g]], matches);
+    ends[g] = matches.size();
+  }
+  if (matches.empty()) return;
+
+  // rebuild the argument list now that matches won't move anymore:
+  std::vector<char*> argv;
+  argv.reserve(argc + matches.size() + 1);
+  size_t g = 0, begin = 0;
+  for (int i = 0; i < argc; i++) {
+    if (g < launch.glob_args.size() && launch.glob_args[g] == i) {
+      for (size_t m = begin; m < ends[g]; m++) argv.push_back(matches[m].data());
+      if (begin == ends[g]) argv.push_back(launch.argv[i]);
+      begin = ends[g++];
+    }
+    else argv.push_back(launch.argv[i]);
+  }
+  argv.push_back(NULL);
+  launch.argv.swap(argv);
+}
+
+// adds the sorted paths matching pattern. '**' as a whole component matches any number
+// of directories (without following links to them):
+void glob(const char* pattern, std::vector<std::string>& out) {
+  std::vector<GlobPattern> components;
+  std::string_view rest = pattern;
+  std::string prefix;
+  if (!rest.empty() && rest[0] == '/') prefix = "/";
+  while (!rest.empty()) {
+    size_t slash = std::min(rest.find('/'), rest.size());
+    if (slash) {
+      components.emplace_back();
+      compile_glob(rest.substr(0, slash), components.back());
+    }
+    rest.remove_prefix(std::min(slash + 1, rest.size()));
+  }
+  if (components.empty()) return;
+  bool dir_only = pattern[strlen(pattern) - 1] == '/';
+
+  size_t first = out.size();
+  dir_walks++;
+  glob_dir(prefix, components, 0, dir_only, out);
+  dir_walks--;
+  std::sort(out.begin() + first, out.end());
+}
+
+void glob_dir(const std::string& prefix, const std::vector<GlobPattern>& components, size_t k,
+              bool dir_only, std::vector<std::string>& out) {
+  const GlobPattern& pattern = components[k];
+  bool last = k + 1 == components.size();
+
+  // plain names need no listing, just a check that they exist at the end:
+  if (pattern.literal) {
+    std::string path = prefix + pattern.prefix;
+    if (!last) glob_dir(path + "/", components, k + 1, dir_only, out);
+    else if (!access(path.c_str(), F_OK)) out.push_back(dir_only ? path + "/" : path);
+    return;
+  }
+
+  // '**' matches nothing at all, or any directory of this one (recursively):
+  if (pattern.globstar && !last) glob_dir(prefix, components, k + 1, dir_only, out);
+
+  // only names starting with the pattern's literal prefix need to be matched:
+  const DirListing& listing = list_dir(prefix.empty() ? "." : prefix);
+  auto it = std::lower_bound(listing.names.begin(), listing.names.end(), pattern.prefix);
+  for (size_t i = it - listing.names.begin(); i < listing.names.size(); i++) {
+    const std::string& name = listing.names[i];
+    if (name.compare(0, pattern.prefix.size(), pattern.prefix)) break;
+    if (name[0] == '.' && !pattern.dot) continue; // hidden files have to be asked for
+    if (pattern.globstar) {
+      if (last && (!dir_only || listing.dirs[i])) out.push_back(prefix + name + (dir_only ? "/" : ""));
+      if (listing.dirs[i] && !listing.links[i]) glob_dir(prefix + name + "/", components, k, dir_only, out);
+      continue;
+    }
+    if (!match_glob(pattern, name)) continue;
+    if (last && (!dir_only || listing.dirs[i])) out.push_back(prefix + name + (dir_only ? "/" : ""));
+    else if (!last && listing.dirs[i]) glob_dir(prefix + name + "/", components, k + 1, dir_only, out);
+  }
+}
+
+// turns a path component into a list of steps to match, once for every name it's
+// matched against:
+void compile_glob(std::string_view text, GlobPattern& pattern) {
+  pattern.globstar = text == "**";
+  pattern.dot = text[0] == '.';
+  bool in_prefix = true;
+  for (size_t i = 0; i < text.size(); i++) {
+    GlobStep step;
+    char c = text[i];
+    if (c == '*') {
+      step.kind = GlobStep::STAR;
+      while (i + 1 < text.size() && text[i+1] == '*') i++; // '**' inside a name is just '*'
+    }
+    else if (c == '?') step.kind = GlobStep::ANY;
+    else if (c == '[' && text.find(']', i + 2) != std::string_view::npos) {
+      // '[abc]', '[a-z]' or '[!abc]' (a ']' right after the '[' is part of the set):
+      step.kind = GlobStep::SET;
+      size_t j = i + 1;
+      bool negate = text[j] == '!' || text[j] == '^';
+      if (negate) j++;
+      size_t first = j;
+      for (; j < text.size() && (text[j] != ']' || j == first); j++) {
+        unsigned char lo = text[j], hi = lo;
+        if (j + 2 < text.size() && text[j+1] == '-' && text[j+2] != ']') {
+          hi = text[j+2];
+          j += 2;
+        }
+        for (unsigned c = lo; c <= hi; c++) step.set.set(c);
+      }
+      if (negate) step.set.flip();
+      i = j;
+    }
+    else {
+      step.kind = GlobStep::CHAR;
+      step.c = c;
+      if (in_prefix) pattern.prefix += c;
+    }
+    if (step.kind != GlobStep::CHAR) in_prefix = false;
+    pattern.steps.push_back(step);
+  }
+  pattern.literal = in_prefix;
+}
+
+// matches without recursion: on a mismatch, the last '*' takes one more character and
+// matching goes on from there, so the time is bounded by the two lengths multiplied:
+bool match_glob(const GlobPattern& pattern, std::string_view name) {
+  const std::vector<GlobStep>& steps = pattern.steps;
+  size_t p = 0, s = 0, star = std::string::npos, star_s = 0;
+  while (s < name.size()) {
+    if (p < steps.size() && steps[p].kind == GlobStep::STAR) {
+      star = p++;
+      star_s = s;
+    }
+    else if (p < steps.size() && steps[p].matches((unsigned char) name[s])) {
+      p++;
+      s++;
+    }
+    else if (star != std::string::npos) {
+      p = star + 1;
+      s = ++star_s;
+    }
+    else return false;
+  }
+  while (p < steps.size() && steps[p].kind == GlobStep::STAR) p++;
+  return p == steps.size();
+}
+
+// the sorted entries of a directory, read again only when its mtime changes (which it
+// does whenever an entry is added, removed or renamed). shared by globs and completion:
+const DirListing& list_dir(const std::string& dir) {
+  static const DirListing none;
+  struct stat st;
+  if (stat(dir.c_str(), &st) == -1 || !S_ISDIR(st.st_mode)) return none;
+  auto cached = dir_cache.find(dir);
+  if (cached != dir_cache.end() && cached->second.mtime.tv_sec == st.st_mtim.tv_sec &&
+      cached->second.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+    return cached->second;
+  }
+
+  // the cache is only meant to last while a few directories are being worked in. it's
+  // not cleared in the middle of a glob, which still walks the listings it has:
+  if (cached == dir_cache.end() && dir_cache.size() >= DIR_CACHE_MAX && !dir_walks) dir_cache.clear();
+  DirListing& listing = dir_cache[dir];
+  listing = DirListing();
+
+  // read the entries in big batches, which takes far fewer calls than readdir() does:
+  int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) return none;
+  static char buf[DIRENT_BUF];
+  std::vector<std::pair<std::string, unsigned char>> entries;
+  while (true) {
+    long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+    if (n <= 0) break;
+    for (long pos = 0; pos < n;) {
+      struct linux_dirent64* ent = (struct linux_dirent64*) (buf + pos);
+      pos += ent->d_reclen;
+      const char* name = ent->d_name;
+      if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) continue;
+      entries.emplace_back(name, ent->d_type);
+    }
+  }
+  std::sort(entries.begin(), entries.end());
+
+  listing.names.reserve(entries.size());
+  for (auto& entry : entries) {
+    bool is_dir = entry.second == DT_DIR, is_link = entry.second == DT_LNK;
+    // only links (and file systems without d_type) need a stat() to tell:
+    struct stat entry_st;
+    if ((is_link || entry.second == DT_UNKNOWN) && !fstatat(fd, entry.first.c_str(), &entry_st, 0)) {
+      is_dir = S_ISDIR(entry_st.st_mode);
+    }
+    listing.names.push_back(std::move(entry.first));
+    listing.dirs.push_back(is_dir);
+    listing.links.push_back(is_link);
+  }
+  close(fd);
+  listing.mtime = st.st_mtim;
+  return listing;
+}
+
+/* ---------- JOB TABLE ---------- */
+
+void sigchld_handler(int signal) {
+  reap_children();
+}
+
+void reap_children() {
+  // collect every finished child (as long as there's room to record it):
+  int saved_errno = errno;
+  while (reaped_count < REAPED_MAX) {
+    Reaped& r = reaped[reaped_count];
+    pid_t pid = wait4(-1, &r.status, WNOHANG, &r.usage);
+    if (pid <= 0) break;
+    r.pid = pid;
+    clock_gettime(CLOCK_MONOTONIC, &r.when);
+    reaped_count++;
+  }
+  errno = saved_errno;
+}
+
+void update_jobs() {
+  if (!pending_execs.empty()) collect_execs(); // before their 'exit' events
+
+  // keep the handler out while we drain what it collected:
+  sigset_t chld, orig;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, &orig);
+
+  // the handler stops reaping when the buffer is full, so drain until nothing is left:
+  do {
+    reap_children();
+    for (int i = 0; i < reaped_count; i++) {
+      auto found = job_pids.find(reaped[i].pid);
+      if (found == job_pids.end()) continue;
+
+      // record the process's exit status and resource usage:
+      auto job = jobs.find(found->second.first);
+      Process& proc = job->second.procs[found->second.second];
+      proc.done = true;
+      proc.status = reaped[i].status;
+      proc.usage = reaped[i].usage;
+      proc.end = reaped[i].when;
+      job_pids.erase(found);
+      if (tracing) trace_event("exit", proc.end, NULL, proc.pid, exit_code(proc.status), proc.cmd);
+      stats_record(proc);
+
+      if (!--job->second.remaining) finish_job_cgroup(job->second);
+    }
+  } while (reaped_count == REAPED_MAX && (reaped_count = 0, true));
+  reaped_count = 0;
+
+  sigprocmask(SIG_SETMASK, &orig, NULL);
+}
+
+int add_job(std::string_view cmd, bool is_background) {
+  // use the next id after the highest one in use, like bash does:
+  int job_id = jobs.empty() ? 1 : jobs.rbegin()->first + 1;
+  Job& job = jobs[job_id];
+  job.cmd = cmd;
+  job.background = is_background;
+  return job_id;
+}
+
+// start is when the process was about to be started, if the caller knows (by default, now):
+void add_process(int job_id, pid_t pid, std::string_view cmd, const struct timespec* start) {
+  Job& job = jobs[job_id];
+  Process proc;
+  proc.pid = pid;
+  proc.cmd = cmd;
+  if (start) proc.start = *start;
+  else clock_gettime(CLOCK_MONOTONIC, &proc.start);
+  job.procs.push_back(proc);
+  job.remaining++;
+  job_pids[pid] = {job_id, (int) job.procs.size() - 1};
+}
+
+// waits for every stage of a job and returns its status. with finished given, the finished
+// job is copied there:
+int wait_job(int job_id, Job* finished) {
+  // block SIGCHLD between checking the job and going to sleep, so we can't miss it:
+  sigset_t chld, orig;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, &orig);
+  struct timespec start;
+  if (tracing) start = trace_now();
+
+  int status = 0;
+  while (1) {
+    update_jobs();
+    auto job = jobs.find(job_id);
+    if (job == jobs.end()) break;
+
+    // a job's status is that of its last stage (which may have run in the shell itself):
+    Job& waiting = job->second;
+    if (!waiting.remaining) {
+      status = waiting.shell_status >= 0 ? waiting.shell_status : exit_code(waiting.procs.back().status);
+      if (tracing) {
+        struct timespec now = trace_now();
+        trace_event("wait", start, &now, 0, job_id, waiting.cmd);
+      }
+      if (finished) *finished = waiting;
+      // a finished foreground job isn't needed anymore (background ones wait to be reported):
+      if (!waiting.background) jobs.erase(job);
+      break;
+    }
+    sigsuspend(&orig);
+  }
+
+  sigprocmask(SIG_SETMASK, &orig, NULL);
+  return status;
+}
+
+// waits until one of the given foreground jobs finishes, removes it from job_ids and returns
+// its id (with its exit status in status):
+int wait_any(std::vector<int>& job_ids, int& status) {
+  sigset_t chld, orig;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, &orig);
+
+  int done = 0;
+  while (!done) {
+    update_jobs();
+    for (size_t i = 0; i < job_ids.size() && !done; i++) {
+      auto job = jobs.find(job_ids[i]);
+      if (job != jobs.end() && job->second.remaining) continue;
+      done = job_ids[i];
+      job_ids.erase(job_ids.begin() + i);
+    }
+    if (!done) sigsuspend(&orig);
+  }
+
+  // wait_job() returns right away now, and does the bookkeeping:
+  status = wait_job(done);
+  sigprocmask(SIG_SETMASK, &orig, NULL);
+  return done;
+}
+
+// the shell's exit code for a wait status (128 + N for processes killed by signal N):
+int exit_code(int status) {
+  if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
+
+// describe how a process (or job) finished, e.g. "Done" or "Exit 2":
+std::string describe_status(int status) {
+  if (WIFSIGNALED(status)) return std::string("Killed (") + strsignal(WTERMSIG(status)) + ")";
+  if (WEXITSTATUS(status)) return "Exit " + std::to_string(WEXITSTATUS(status));
+  return "Done";
+}
+
+// a job's status is the status of its last stage:
+std::string describe_job(const Job& job) {
+  return job.remaining ? "Running" : describe_status(job.procs.back().status);
+}
+
+void notify_jobs() {
+  update_jobs();
+
+  // tell the user about finished background jobs, and forget them:
+  for (auto job = jobs.begin(); job != jobs.end();) {
+    if (job->second.background && !job->second.remaining) {
+      if (interactive) out_printf("[%d] %s\t%s\n", job->first, describe_job(job->second).c_str(), job->second.cmd.c_str());
+      job = jobs.erase(job);
+    }
+    else job++;
+  }
+}
+
+int handle_jobs(int argc, char** argv) {
+  update_jobs();
+  bool is_long = (argc > 1 && !strcmp(argv[1], "-l")); // 'jobs -l' also lists each process
+
+  for (const auto& entry : jobs) {
+    const Job& job = entry.second;
+    if (!job.background) continue;
+    printf("[%d] %s\t%s\n", entry.first, describe_job(job).c_str(), job.cmd.c_str());
+    if (!is_long) continue;
+    print_job_limits(job);
+
+    for (const Process& proc : job.procs) {
+      if (!proc.done) {
+        printf("     %d Running\t%s\n", proc.pid, proc.cmd.c_str());
+        continue;
+      }
+      printf("     %d %s\t%s (user %ld.%03lds, sys %ld.%03lds, maxrss %ld KiB)\n", proc.pid,
+             describe_status(proc.status).c_str(), proc.cmd.c_str(),
+             (long) proc.usage.ru_utime.tv_sec, (long) proc.usage.ru_utime.tv_usec / 1000,
+             (long) proc.usage.ru_stime.tv_sec, (long) proc.usage.ru_stime.tv_usec / 1000,
+             proc.usage.ru_maxrss);
+    }
+  }
+  return 0;
+}
+
+int handle_wait(int argc, char** argv) {
+  // no arguments: wait for every background job:
+  if (argc < 2) {
+    update_jobs();
+    std::vector<int> ids;
+    for (const auto& entry : jobs) if (entry.second.background) ids.push_back(entry.first);
+    int status = 0;
+    for (int id : ids) status = wait_job(id);
+    return status;
+  }
+
+  // otherwise wait for each given job (%N) or process id:
+  int status = 0;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    int job_id = -1;
+    if (arg[0] == '%') job_id = atoi(arg + 1);
+    else {
+      auto found = job_pids.find(atoi(arg));
+      if (found != job_pids.end()) job_id = found->second.first;
+    }
+
+    // finished jobs can still be waited for until they've been reported:
+    if (!jobs.count(job_id)) {
+      fprintf(stderr, "[wait] error: no such job: %s\n", arg);
+      status = 127;
+      continue;
+    }
+    status = wait_job(job_id);
+  }
+  return status;
+}
+
+/* ---------- COMMAND STATS ---------- */
+
+// the latencies and exit codes of every process run under a command name:
+struct CommandStats {
+  uint32_t buckets[HIST_BUCKETS] = {};
+  uint32_t exits[256] = {}; // how often each exit code came up
+  uint64_t count = 0, failures = 0;
+  uint64_t max_us = 0;
+};
+
+std::unordered_map<std::string, CommandStats> command_stats; // at most STATS_COMMANDS + 1 names
+struct timespec stats_written = {}; // when $MYSHELL_STATS was last written
+
+// counts a reaped process under its command's name (without the directory it's in):
+void stats_record(const Process& proc) {
+  std::string_view cmd = proc.cmd;
+  while (cmd.find(' ') != std::string_view::npos && is_assignment(cmd.substr(0, cmd.find(' ')))) {
+    cmd.remove_prefix(cmd.find(' ') + 1);
+  }
+  std::string name(cmd.substr(0, cmd.find(' ')));
+  name.erase(std::remove(name.begin(), name.end(), '"'), name.end());
+  if (!name.empty() && name[0] == '(') name = "(subshell)";
+  else if (name.find('/') != std::string::npos) name.erase(0, name.rfind('/') + 1);
+  for (char& c : name) if (c == '\\') c = '_'; // so it can be a Prometheus label
+  auto found = command_stats.find(name);
+  if (found == command_stats.end()) {
+    if (command_stats.size() >= STATS_COMMANDS) name = "(other)";
+    found = command_stats.emplace(name, CommandStats()).first;
+  }
+  CommandStats& stats = found->second;
+
+  double elapsed = seconds_between(proc.start, proc.end) * 1e6;
+  uint64_t us = elapsed > 0 ? elapsed : 0;
+  int code = exit_code(proc.status);
+  stats.buckets[hist_bucket(us)]++;
+  stats.exits[code & 0xff]++;
+  stats.count++;
+  stats.failures += code != 0;
+  stats.max_us = std::max(stats.max_us, us);
+}
+
+int hist_bucket(uint64_t us) {
+  if (us < 32) return us;
+  int top = 63 - __builtin_clzll(us);
+  if (top > 40) return HIST_BUCKETS - 1;
+  return 32 + (top - 5) * 16 + (int) (us >> (top - 4)) - 16;
+}
+
+// the largest value that falls in a bucket:
+uint64_t hist_upper(int bucket) {
+  if (bucket < 32) return bucket;
+  int top = (bucket - 32) / 16 + 5;
+  uint64_t sub = (bucket - 32) % 16 + 16;
+  return ((sub + 1) << (top - 4)) - 1;
+}
+
+// the latency that a fraction q of the runs didn't go past (at most the slowest one):
+uint64_t hist_percentile(const CommandStats& stats, double q) {
+  uint64_t rank = std::max<uint64_t>(1, (uint64_t) (q * stats.count + 0.999999));
+  uint64_t seen = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    seen += stats.buckets[i];
+    if (seen >= rank) return std::min(hist_upper(i), stats.max_us);
+  }
+  return stats.max_us;
+}
+
+// the stats in the Prometheus text format, which is what $MYSHELL_STATS gets:
+void write_stats(FILE* out) {
+  const double quantiles[] = {0.5, 0.9, 0.99};
+  fprintf(out, "# TYPE myshell_command_seconds summary\n");
+  for (const auto& [name, stats] : command_stats) {
+    for (double q : quantiles) {
+      fprintf(out, "myshell_command_seconds{command=\"%s\",quantile=\"%g\"} %.6f\n", name.c_str(), q,
+              hist_percentile(stats, q) / 1e6);
+    }
+    fprintf(out, "myshell_command_seconds_count{command=\"%s\"} %lu\n", name.c_str(), (unsigned long) stats.count);
+  }
+  fprintf(out, "# TYPE myshell_command_exits_total counter\n");
+  for (const auto& [name, stats] : command_stats) {
+    for (int code = 0; code < 256; code++) {
+      if (!stats.exits[code]) continue;
+      fprintf(out, "myshell_command_exits_total{command=\"%s\",code=\"%d\"} %u\n", name.c_str(), code,
+              stats.exits[code]);
+    }
+  }
+}
+
+// writes the stats to $MYSHELL_STATS if it's time to (or with force, anyway). they're
+// written next to it first, so a scraper never sees half of them:
+void stats_dump(bool force) {
+  const char* path = getenv("MYSHELL_STATS");
+  if (!path || !*path) return;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (!force && (!stats_interval || now.tv_sec - stats_written.tv_sec < stats_interval)) return;
+  stats_written = now;
+
+  std::string tmp = std::string(path) + ".tmp." + std::to_string(getpid());
+  FILE* out = fopen(tmp.c_str(), "w");
+  if (!out) {
+    fprintf(stderr, "[stats] error: %s: %s\n", tmp.c_str(), strerror(errno));
+    return;
+  }
+  write_stats(out);
+  if (fclose(out) == 0) rename(tmp.c_str(), path);
+  else unlink(tmp.c_str());
+}
+
+void stats_dump_at_exit() {
+  if (getpid() == shell_pid) stats_dump(true);
+}
+
+bool set_statsinterval(const char* arg) {
+  char* end;
+  long interval = strtol(arg, &end, 10);
+  if (end == arg || *end || interval < 0) {
+    fprintf(stderr, "[set] error: invalid stats interval %s.\n", arg);
+    return false;
+  }
+  stats_interval = interval;
+  return true;
+}
+
+// 'stats' lists how long the commands that ran took, by name (the most frequent first).
+// 'stats -p' prints them for Prometheus, and 'stats -c' forgets them:
+int handle_stats(int argc, char** argv) {
+  if (argc > 1 && !strcmp(argv[1], "-c")) {
+    command_stats.clear();
+    return 0;
+  }
+  if (argc > 1 && !strcmp(argv[1], "-p")) {
+    write_stats(stdout);
+    return 0;
+  }
+  if (argc > 1) {
+    fprintf(stderr, "[stats] error: usage: stats [-p | -c]\n");
+    return 1;
+  }
+
+  std::vector<const std::pair<const std::string, CommandStats>*> rows;
+  for (const auto& entry : command_stats) rows.push_back(&entry);
+  std::sort(rows.begin(), rows.end(), [](auto a, auto b) { return a->second.count > b->second.count; });
+  printf("%-24s %7s %7s %10s %10s %10s %10s  %s\n", "command", "count", "failed", "p50", "p90", "p99", "max",
+         "exit codes");
+  for (const auto* row : rows) {
+    const CommandStats& stats = row->second;
+    printf("%-24.24s %7lu %7lu %9.3fms %9.3fms %9.3fms %9.3fms ", row->first.c_str(), (unsigned long) stats.count,
+           (unsigned long) stats.failures, hist_percentile(stats, 0.5) / 1e3, hist_percentile(stats, 0.9) / 1e3,
+           hist_percentile(stats, 0.99) / 1e3, stats.max_us / 1e3);
+    for (int code = 1; code < 256; code++) if (stats.exits[code]) printf(" %d:%u", code, stats.exits[code]);
+    printf("\n");
+  }
+  return 0;
+}
+
+/* ---------- BUILTIN COMMANDS ---------- */
+
+int handle_cd(int argc, char** argv) {
+  // no arg provided, cd to home directory (as the unix shell does):
+  if (argc < 2) {
+    chdir(getenv("HOME"));
+    return 0;
+  }
+
+  // if arg provided, change the directory appropriately.
+  // if no such directory, print an error message:
+  if (chdir(argv[1]) == -1) {
+    print_error(2);
+    return 1;
+  }
+  return 0;
+}
+
+// NOTE: we ignore anything that comes after 'pwd' as the Unix shell does
+int handle_pwd(int argc, char** argv) {
+  char* cwd = getcwd(NULL, 0);
+  printf("%s\n", cwd);
+  free(cwd);
+  return 0;
+}
+
+int handle_color(int argc, char** argv) {
+  if (argc < 2 || COLORS.find(argv[1]) == COLORS.end()) {
+    fprintf(stderr, "[color] error: no such color found.\n");
+    return 1;
+  }
+  text_color = COLORS.at(argv[1]);
+  printf("%s", text_color.c_str());
+  return 0;
+}
+
+int handle_clear(int argc, char** argv) {
+  clear_screen();
+  return 0;
+}
+
+// 'exit [N]' quits the shell (or just the child, inside a pipeline), by default with
+// the status of the last command:
+int handle_exit(int argc, char** argv) {
+  fflush(stdout);
+  exit(argc > 1 ? atoi(argv[1]) : last_status);
+}
+
+int run_builtin(const Launch& launch) {
+  // the builtin uses our own descriptors, so point them at the redirections for the duration:
+  std::vector<std::pair<int, int>> moves, saved;
+  std::vector<int> opened;
+  bool redirected = resolve_fds(launch, -1, -1, moves, opened);
+  if (redirected) {
+    fflush(stdout);
+    for (const auto& move : moves) saved.push_back({move.first, fcntl(move.first, F_DUPFD_CLOEXEC, 10)});
+    for (const auto& move : moves) dup2(move.second, move.first);
+  }
+  for (int fd : opened) close(fd);
+  if (!redirected) return 1;
+
+  // 'NAME=value builtin' sets NAME (exported) only while the builtin runs:
+  struct Saved {
+    std::string name, value;
+    bool set, exported;
+  };
+  std::vector<Saved> saved_vars;
+  for (std::string_view assign : launch.assigns) {
+    std::string name(assign.substr(0, assign.find('=')));
+    auto var = variables.find(name);
+    bool set = var != variables.end();
+    saved_vars.push_back({name, set ? get_var(name) : "", set, set && var->second.env_index >= 0});
+    set_var(name, assign.substr(assign.find('=') + 1), true);
+  }
+
+  int argc = launch.argv.size() - 1;
+  int status = BUILTINS.at(launch.argv[0])(argc, (char**) launch.argv.data());
+
+  // put them back, latest first (a name may be given twice):
+  for (auto var = saved_vars.rbegin(); var != saved_vars.rend(); var++) {
+    if (!var->exported) unset_var(var->name);
+    if (var->set) set_var(var->name, var->value, var->exported);
+  }
+
+  // make sure the output comes before anything the next command prints, then put
+  // our descriptors back:
+  fflush(stdout);
+  for (const auto& [fd, copy] : saved) {
+    if (copy < 0) close(fd);
+    else {
+      dup2(copy, fd);
+      close(copy);
+    }
+  }
+  return status;
+}
+
+bool is_builtin(const Launch& launch) {
+  return launch.argv[0] && BUILTINS.count(launch.argv[0]);
+}
+
+// puts the text of a here-string or here-document in an anonymous in-memory file, sealed
+// so the command can only read it (no temporary file, and no process feeding a pipe):
+int open_here(const Redirect& redirect) {
+  int fd = memfd_create("myshell-here", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) return -1;
+  std::string_view text = redirect.here_text;
+  bool ok = true;
+  for (size_t done = 0; ok && done < text.size();) {
+    ssize_t n = write(fd, text.data() + done, text.size() - done);
+    ok = n > 0;
+    if (ok) done += n;
+  }
+  if (ok && redirect.here_newline) ok = write(fd, "\n", 1) == 1;
+  fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+  if (!ok || lseek(fd, 0, SEEK_SET) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* ---------- STARTUP ---------- */
+
+// runs ~/.myshellrc. when it only configures the shell (variables, options and the
+// like), what its commands came down to is kept in a snapshot and replayed on later
+// startups instead, as long as neither the file nor anything it reads has changed:
+void load_rc() {
+  if (!getenv("HOME")) return;
+  std::string path = std::string(getenv("HOME")) + "/.myshellrc";
+  struct stat st;
+  if (stat(path.c_str(), &st) == -1) return;
+
+  std::string dir = cache_dir(NULL);
+  std::string snapshot = dir.empty() ? "" : dir + "/rc.snapshot";
+  if (!snapshot.empty() && replay_snapshot(snapshot, st)) {
+    startup.rc = "snapshot";
+    return;
+  }
+
+  LineReader reader;
+  if (!open_script(reader, path.c_str())) {
+    fprintf(stderr, "[myShell] error: could not read %s: %s\n", path.c_str(), strerror(errno));
+    return;
+  }
+  RcRecording recording;
+  rc_recording = &recording;
+  // the rc file's lines only run once, so they're not worth keeping in the plan cache:
+  std::string line;
+  Plan plan;
+  while (read_line(reader, line)) {
+    parse_plan(line, plan);
+    read_heredocs(reader, plan);
+    last_status = run_rc_line(plan, recording);
+  }
+  rc_recording = NULL;
+  if (reader.fd >= 0) close(reader.fd);
+  else if (reader.data) munmap((void*) (reader.data - (st.st_size - reader.len)), st.st_size);
+
+  startup.rc = recording.cacheable ? "parsed" : "run, not cacheable";
+  if (recording.cacheable && !snapshot.empty()) write_snapshot(snapshot, st, recording);
+}
+
+// runs a line of the rc file, recording its commands if all it does is change the shell's
+// settings (assignments, and builtins like 'set' or 'alias' given plain arguments):
+int run_rc_line(const Plan& plan, RcRecording& recording) {
+  bool settings = plan.error.empty();
+  for (const Step& step : plan.steps) {
+    if (step.op == STEP_END) continue;
+    const PipelinePlan* pipeline = step.op == STEP_PIPELINE ? &plan.pipelines[step.arg] : NULL;
+    const CommandPlan* command = pipeline && pipeline->stages.size() == 1 ? &pipeline->stages[0] : NULL;
+    settings = settings && command && command->subshell < 0 && command->redirects.empty() &&
+               (command->assignments || (command->words.size() > 1 && !command->words[0].expand &&
+                                         RC_BUILTINS.count(command->words[0].literal)));
+    for (size_t i = 0; settings && i < command->words.size(); i++) settings = !command->words[i].wildcard;
+  }
+  if (!settings) {
+    recording.cacheable = false;
+    startup.rc_commands += plan.pipelines.size();
+    return run_plan(plan);
+  }
+
+  int status = 0;
+  for (const Step& step : plan.steps) {
+    if (step.op == STEP_PIPELINE) status = last_status = run_rc_command(plan.pipelines[step.arg].stages[0], recording);
+  }
+  return status;
+}
+
+// runs a command that only changes settings, recording it as an op:
+int run_rc_command(const CommandPlan& command, RcRecording& recording) {
+  startup.rc_commands++;
+  Launch launch;
+  prepare_launch(command, launch);
+  char assign[] = "=";
+  std::vector<char*> argv;
+  if (command.assignments) argv.push_back(assign);
+  argv.insert(argv.end(), launch.argv.begin(), launch.argv.end() - 1);
+
+  // the op is stored as its argument count and arguments. whatever it sets is now
+  // decided by the rc file (so references to it don't need checking later):
+  uint32_t argc = argv.size();
+  recording.ops.append((const char*) &argc, sizeof(argc));
+  for (char* arg : argv) recording.ops.append(arg, strlen(arg) + 1);
+  recording.op_count++;
+  for (size_t i = 1; i < argv.size(); i++) {
+    std::string_view arg = argv[i];
+    bool sets = argv[0] == assign || !strcmp(argv[0], "unset") ||
+                (!strcmp(argv[0], "export") && arg.find('=') != std::string_view::npos);
+    if (sets) recording.seen.insert(std::string(arg.substr(0, arg.find('='))));
+  }
+  return apply_rc_op(argc, argv.data());
+}
+
+// does what a recorded command did: '=' for assignments, a builtin otherwise:
+int apply_rc_op(int argc, char** argv) {
+  if (!strcmp(argv[0], "=")) return assign_vars(argc - 1, argv + 1);
+  return BUILTINS.at(argv[0])(argc, argv);
+}
+
+// called for every variable the rc file expands. the first value it saw of each one
+// that the rc didn't set itself goes into the snapshot, which is only used while the
+// variable still has that value:
+void note_rc_ref(std::string_view name, const char* value) {
+  if (name == "?" || name == "$") {
+    rc_recording->cacheable = false;
+    return;
+  }
+  if (!rc_recording->seen.insert(std::string(name)).second) return;
+  rc_recording->refs += value ? '1' : '0';
+  rc_recording->refs.append(name);
+  rc_recording->refs += '\0';
+  rc_recording->refs.append(value ? value : "");
+  rc_recording->refs += '\0';
+  rc_recording->ref_count++;
+}
+
+// applies the snapshot if it was made from this rc file (and the variables it depends
+// on are unchanged). the recorded arguments are used in place, from the mapping:
+bool replay_snapshot(const std::string& path, const struct stat& rc) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  struct stat st;
+  void* map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(RcSnapshotHeader)) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) return false;
+
+  const RcSnapshotHeader* header = (const RcSnapshotHeader*) map;
+  const char* at = (const char*) (header + 1);
+  const char* end = (const char*) map + st.st_size;
+  bool valid = !memcmp(header->magic, "MSRC", 4) && header->version == RC_SNAPSHOT_VERSION &&
+               header->rc_ino == (uint64_t) rc.st_ino && header->rc_size == (uint64_t) rc.st_size &&
+               header->rc_mtime_sec == rc.st_mtim.tv_sec && header->rc_mtime_nsec == rc.st_mtim.tv_nsec;
+
+  // reads the next NUL-terminated string, NULL if the file is cut short:
+  auto next = [&]() -> char* {
+    const char* nul = at < end ? (const char*) memchr(at, '\0', end - at) : NULL;
+    if (!nul) return NULL;
+    char* str = (char*) at;
+    at = nul + 1;
+    return str;
+  };
+  for (uint32_t i = 0; valid && i < header->refs; i++) {
+    char set = at < end ? *at++ : 0;
+    const char* name = next();
+    const char* value = next();
+    const char* now = name && value ? get_var(name) : NULL;
+    valid = name && value && (set == '1' ? now && !strcmp(now, value) : !now);
+  }
+
+  // every op is checked before any of them runs, so a damaged file changes nothing:
+  std::vector<char*> argv; // the ops' arguments, each list NULL-terminated
+  for (uint32_t i = 0; valid && i < header->ops; i++) {
+    uint32_t argc;
+    valid = (size_t) (end - at) >= sizeof(argc) && (memcpy(&argc, at, sizeof(argc)), argc > 0);
+    at += sizeof(argc);
+    for (uint32_t k = 0; valid && k < argc; k++) {
+      argv.push_back(next());
+      valid = argv.back() != NULL;
+    }
+    valid = valid && (!strcmp(argv[argv.size() - argc], "=") || RC_BUILTINS.count(argv[argv.size() - argc]));
+    argv.push_back(NULL);
+  }
+  if (valid) {
+    for (size_t i = 0; i < argv.size(); i++) {
+      size_t start = i;
+      while (argv[i]) i++;
+      last_status = apply_rc_op(i - start, argv.data() + start);
+      startup.rc_commands++;
+    }
+  }
+  munmap(map, st.st_size);
+  return valid;
+}
+
+void write_snapshot(const std::string& path, const struct stat& rc, const RcRecording& recording) {
+  RcSnapshotHeader header = {{'M', 'S', 'R', 'C'}, RC_SNAPSHOT_VERSION, (uint64_t) rc.st_ino,
+                             (uint64_t) rc.st_size, rc.st_mtim.tv_sec, rc.st_mtim.tv_nsec,
+                             recording.ref_count, recording.op_count};
+  std::string data((const char*) &header, sizeof(header));
+  data += recording.refs;
+  data += recording.ops;
+
+  // written next to it and renamed, so another shell starting up never sees half of it:
+  std::string tmp = path + ".tmp." + std::to_string(getpid());
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) return;
+  bool ok = write(fd, data.data(), data.size()) == (ssize_t) data.size();
+  close(fd);
+  if (!ok || rename(tmp.c_str(), path.c_str()) == -1) unlink(tmp.c_str());
+}
+
+double ms_since(struct timespec& since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double ms = seconds_between(since, now) * 1e3;
+  since = now;
+  return ms;
+}
+
+// 'myShell --startup-stats' prints where the time until the first prompt went:
+void print_startup_stats() {
+  struct timespec now = startup.start;
+  double total = ms_since(now);
+  double other = total - startup.environment_ms - startup.rc_ms - startup.history_ms;
+  fprintf(stderr, "startup: %.3f ms to the first prompt\n", total);
+  fprintf(stderr, "  %-12s %8.3f ms  (%zu variables)\n", "environment", startup.environment_ms, variables.size());
+  fprintf(stderr, "  %-12s %8.3f ms  (%s, %d commands)\n", "rc file", startup.rc_ms, startup.rc, startup.rc_commands);
+  fprintf(stderr, "  %-12s %8.3f ms\n", "history", startup.history_ms);
+  fprintf(stderr, "  %-12s %8.3f ms\n", "other", other);
+}
+
+/* ---------- COPY ENGINE ---------- */
+
+// stages that only move data from files to their output are done by the shell without
+// starting a process: 'cat' with only file arguments, or a lone '< file' or '> file'
+// (with no other redirections, and the last only creates the file):
+bool is_copy_stage(const Launch& launch) {
+  const Redirect* redirect = launch.redirects.empty() ? NULL : &launch.redirects[0];
+  if (launch.redirects.size() > 1) return false;
+  if (redirect && (redirect->here || redirect->copy_of >= 0 || redirect->fd > STDOUT_FILENO)) return false;
+  if (!launch.argv[0]) return redirect;
+  if (strcmp(launch.argv[0], "cat") || !launch.argv[1] || (redirect && redirect->fd == STDIN_FILENO)) return false;
+  for (int i = 1; launch.argv[i]; i++) {
+    if (launch.argv[i][0] == '-') return false; // options (or '-' for stdin) need the real cat
+  }
+  return true;
+}
+
+int run_copy(const Launch& launch, int out_fd) {
+  const char* name = launch.argv[0] ? launch.argv[0] : "myShell";
+
+  // '> file' (or 'cat x > file') writes to the file instead:
+  const Redirect* redirect = launch.redirects.empty() ? NULL : &launch.redirects[0];
+  const Redirect* output = redirect && redirect->fd == STDOUT_FILENO ? redirect : NULL;
+  int dest = out_fd;
+  if (output) {
+    dest = open(output->path, output->flags | O_CLOEXEC, RW_PERMS);
+    if (dest < 0) {
+      fprintf(stderr, "%s: %s: %s\n", name, output->path, strerror(errno));
+      return 1;
+    }
+  }
+
+  // a lone '> file' (or '>> file') only creates or truncates it, like ': > file', and
+  // doesn't read anything:
+  if (output && !launch.argv[0]) {
+    close(dest);
+    return 0;
+  }
+
+  // let CTRL+C stop the copy (instead of the shell), and keep a closed pipe from killing us:
+  struct sigaction interrupt = {}, orig_int, orig_pipe;
+  interrupt.sa_handler = copyInterruptHandler;
+  sigaction(SIGINT, &interrupt, &orig_int);
+  interrupt.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &interrupt, &orig_pipe);
+  copy_interrupted = 0;
+  fflush(stdout);
+
+  // copy each file in turn ('< file' is the only source):
+  int status = 0;
+  int count = launch.argv[0] ? launch.argv.size() - 2 : 1;
+  for (int i = 0; i < count && !copy_interrupted; i++) {
+    const char* path = launch.argv[0] ? launch.argv[i+1] : redirect->path;
+    int src = open(path, O_RDONLY | O_CLOEXEC);
+    if (src < 0) {
+      fprintf(stderr, "%s: %s: %s\n", name, path, strerror(errno));
+      status = 1;
+      continue;
+    }
+    int err = copy_fd(src, dest) ? errno : 0;
+    close(src);
+
+    // the reader went away, just like cat would be killed by SIGPIPE:
+    if (err == EPIPE) break;
+    if (err) {
+      if (err != EINTR) fprintf(stderr, "%s: %s: %s\n", name, path, strerror(err));
+      status = 1;
+    }
+  }
+  if (copy_interrupted) status = 128 + SIGINT;
+
+  sigaction(SIGINT, &orig_int, NULL);
+  sigaction(SIGPIPE, &orig_pipe, NULL);
+  if (dest != out_fd) close(dest);
+  return status;
+}
+
+int copy_fd(int in_fd, int out_fd) {
+  // pick the cheapest way to move data between these kinds of files, all of which keep
+  // the data in the kernel except for the last one:
+  enum { COPY_RANGE, SENDFILE, SPLICE, READ_WRITE } method = READ_WRITE;
+  struct stat in_st, out_st;
+  if (fstat(in_fd, &in_st) == -1 || fstat(out_fd, &out_st) == -1) return -1;
+  bool has_pipe = S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode);
+  if (S_ISREG(in_st.st_mode)) method = S_ISREG(out_st.st_mode) ? COPY_RANGE : SENDFILE;
+  else if (has_pipe) method = SPLICE;
+
+  static char buf[COPY_CHUNK];
+  bool first = true; // traced as 'first-byte'
+  while (!copy_interrupted) {
+    ssize_t n;
+    if (method == COPY_RANGE) n = copy_file_range(in_fd, NULL, out_fd, NULL, COPY_CHUNK, 0);
+    else if (method == SENDFILE) n = sendfile(out_fd, in_fd, NULL, COPY_CHUNK);
+    else if (method == SPLICE) n = splice(in_fd, NULL, out_fd, NULL, COPY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+    else {
+      n = read(in_fd, buf, COPY_CHUNK);
+      for (ssize_t done = 0, w; n > 0 && done < n; done += w) {
+        w = write(out_fd, buf + done, n - done);
+        if (w < 0) return -1;
+      }
+    }
+
+    if (n == 0) return 0;
+    if (n > 0 && first && tracing) trace_event("first-byte", trace_now(), NULL, 0, in_fd, "copy");
+    if (n > 0) first = false;
+    if (n > 0 || errno == EINTR) continue;
+
+    // the kernel can't do this kind of copy between these files (EBADF is what
+    // copy_file_range() reports for O_APPEND output), so try the next way:
+    if (errno == EINVAL || errno == ENOSYS || errno == EXDEV || errno == EOPNOTSUPP ||
+        (errno == EBADF && method != READ_WRITE)) {
+      if (method == COPY_RANGE) method = SENDFILE;
+      else if (method == SENDFILE && has_pipe) method = SPLICE;
+      else if (method != READ_WRITE) method = READ_WRITE;
+      else return -1;
+      continue;
+    }
+    return -1;
+  }
+  errno = EINTR;
+  return -1;
+}
+
+void copyInterruptHandler(int signal) {
+  copy_interrupted = 1;
+}
+
+/* ---------- ALIASES ---------- */
+
+// the trie node for name, with the path to it created if asked to. -1 if there's none:
+int alias_node(std::string_view name, bool create) {
+  if (alias_trie.empty()) alias_trie.emplace_back();
+  int node = 0;
+  for (char c : name) {
+    auto& next = alias_trie[node].next;
+    auto edge = std::lower_bound(next.begin(), next.end(), std::make_pair(c, 0));
+    if (edge != next.end() && edge->first == c) {
+      node = edge->second;
+      continue;
+    }
+    if (!create) return -1;
+    int child = alias_trie.size();
+    next.insert(edge, std::make_pair(c, child));
+    alias_trie.emplace_back(); // may move the nodes, so next isn't used after this
+    alias_trie.back().edge = c;
+    node = child;
+  }
+  return node;
+}
+
+// what name stands for, NULL if it isn't an alias:
+const std::string* alias_find(std::string_view name) {
+  if (!alias_count) return NULL;
+  int node = alias_node(name, false);
+  return node >= 0 && alias_trie[node].is_alias ? &alias_trie[node].value : NULL;
+}
+
+void alias_set(std::string_view name, std::string_view value) {
+  AliasNode& node = alias_trie[alias_node(name, true)];
+  alias_count += !node.is_alias;
+  node.is_alias = true;
+  node.value = value;
+  alias_generation++;
+}
+
+// removed names keep their nodes, which are reused if the name is defined again:
+bool alias_unset(std::string_view name) {
+  int node = alias_node(name, false);
+  if (node < 0 || !alias_trie[node].is_alias) return false;
+  alias_trie[node].is_alias = false;
+  alias_trie[node].value.clear();
+  alias_count--;
+  alias_generation++;
+  return true;
+}
+
+// every alias starting with prefix, in order (for listing them and for tab completion):
+void alias_choices(const std::string& prefix, std::vector<std::string>& choices) {
+  int node = alias_count ? alias_node(prefix, false) : -1;
+  if (node < 0) return;
+  // depth first, and the name is only ever changed at its end since the part before
+  // it is the path of the node's parent:
+  std::string name = prefix;
+  std::vector<std::pair<int, size_t>> stack = {{node, name.size()}}; // node, length of its name
+  while (!stack.empty()) {
+    auto [at, len] = stack.back();
+    stack.pop_back();
+    name.resize(len);
+    if (len > prefix.size()) name[len - 1] = alias_trie[at].edge;
+    if (alias_trie[at].is_alias) choices.push_back(name);
+    const auto& next = alias_trie[at].next;
+    for (auto edge = next.rbegin(); edge != next.rend(); edge++) stack.push_back({edge->second, len + 1});
+  }
+}
+
+bool valid_alias_name(std::string_view name) {
+  return !name.empty() && name.find_first_of(" \t\"'|&;<>()$`\\/=") == std::string_view::npos;
+}
+
+// 'alias name=value...' defines aliases, 'alias name...' shows them, and plain 'alias'
+// lists all of them:
+int handle_alias(int argc, char** argv) {
+  std::vector<std::string> names;
+  if (argc == 1) alias_choices("", names);
+  int status = 0;
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+    size_t eq = std::min(arg.find('='), arg.size());
+    if (!valid_alias_name(arg.substr(0, eq))) {
+      fprintf(stderr, "[alias] error: %s: not a valid name.\n", argv[i]);
+      status = 1;
+    }
+    else if (eq < arg.size()) alias_set(arg.substr(0, eq), arg.substr(eq + 1));
+    else if (alias_find(arg)) names.emplace_back(arg);
+    else {
+      fprintf(stderr, "[alias] error: %s: not found.\n", argv[i]);
+      status = 1;
+    }
+  }
+  for (const std::string& name : names) printf("alias %s=\"%s\"\n", name.c_str(), alias_find(name)->c_str());
+  return status;
+}
+
+// 'unalias name...' removes aliases, 'unalias -a' all of them:
+int handle_unalias(int argc, char** argv) {
+  if (argc == 2 && !strcmp(argv[1], "-a")) {
+    alias_trie.clear();
+    alias_count = 0;
+    alias_generation++;
+    return 0;
+  }
+  if (argc < 2) {
+    fprintf(stderr, "[unalias] error: usage: unalias name... | unalias -a\n");
+    return 1;
+  }
+  int status = 0;
+  for (int i = 1; i < argc; i++) {
+    if (alias_unset(argv[i])) continue;
+    fprintf(stderr, "[unalias] error: %s: not found.\n", argv[i]);
+    status = 1;
+  }
+  return status;
+}
+
+/* ---------- VARIABLES ---------- */
+
+void init_variables() {
+  envp.clear();
+  envp.push_back(NULL);
+  for (char** env = environ; *env; env++) {
+    const char* eq = strchr(*env, '=');
+    if (eq) set_var(std::string_view(*env, eq - *env), eq + 1, true);
+  }
+}
+
+// the value of a variable, NULL if it isn't set:
+const char* get_var(std::string_view name) {
+  // before init_variables() (e.g. in the benchmarks), the environment is all there is:
+  if (envp.empty()) return getenv(std::string(name).c_str());
+  auto var = variables.find(std::string(name));
+  return var == variables.end() ? NULL : var->second.entry.c_str() + var->second.name_len + 1;
+}
+
+void set_var(std::string_view name, std::string_view value, bool exported) {
+  if (envp.empty()) envp.push_back(NULL);
+  Variable& var = variables[std::string(name)];
+  var.entry.assign(name);
+  var.entry += '=';
+  var.entry += value;
+  var.name_len = name.size();
+
+  // only the changed entry is touched (it may have moved when its string grew):
+  if (var.env_index >= 0) envp[var.env_index] = var.entry.data();
+  else if (exported) {
+    var.env_index = envp.size() - 1;
+    envp.insert(envp.end() - 1, var.entry.data());
+  }
+  environ = envp.data();
+
+  // remembered command locations may not be what $PATH finds anymore:
+  if (name == "PATH") path_cache.clear();
+}
+
+void unset_var(std::string_view name) {
+  auto var = variables.find(std::string(name));
+  if (var == variables.end()) return;
+
+  // move the last exported entry into the hole, so the environment stays compact:
+  int index = var->second.env_index;
+  if (index >= 0) {
+    int last = envp.size() - 2;
+    if (index != last) {
+      std::string_view moved = envp[last];
+      variables[std::string(moved.substr(0, moved.find('=')))].env_index = index;
+      envp[index] = envp[last];
+    }
+    envp.erase(envp.end() - 2);
+    environ = envp.data();
+  }
+  variables.erase(var);
+  if (name == "PATH") path_cache.clear();
+}
+
+bool valid_name(std::string_view name) {
+  if (name.empty() || isdigit((unsigned char) name[0])) return false;
+  for (char c : name) {
+    if (!isalnum((unsigned char) c) && c != '_') return false;
+  }
+  return true;
+}
+
+// whether the word is 'NAME=value' (a command starting with one only has assignments):
+bool is_assignment(std::string_view word) {
+  size_t eq = word.find('=');
+  return eq != std::string_view::npos && valid_name(word.substr(0, eq));
+}
+
+// sets every 'NAME=value' of a command (whose values have been expanded already):
+int assign_vars(int argc, char** argv) {
+  int status = 0;
+  for (int i = 0; i < argc; i++) {
+    std::string_view token = argv[i];
+    size_t eq = token.find('=');
+    if (eq == std::string_view::npos || !valid_name(token.substr(0, eq))) {
+      fprintf(stderr, "[myShell] error: %s: not an assignment.\n", argv[i]);
+      status = 1;
+      continue;
+    }
+    set_var(token.substr(0, eq), token.substr(eq + 1), false);
+  }
+  return status;
+}
+
+// reads the variable reference at input[i] ('$NAME', '${NAME}', '$?' or '$$'), setting
+// value to what it expands to. returns the length of the reference, or 0 if there
+// isn't one (leaving value empty):
+size_t var_ref(std::string_view input, size_t i, std::string_view& value) {
+  static char number[24];
+  value = std::string_view();
+  if (i + 1 >= input.size()) return 0;
+  char c = input[i+1];
+  if (c == '?' || c == '$') {
+    snprintf(number, sizeof(number), "%d", c == '?' ? last_status : (int) getpid());
+    value = number;
+    if (rc_recording) note_rc_ref(input.substr(i + 1, 1), number);
+    return 2;
+  }
+
+  size_t start = i + 1, end = start;
+  bool braced = c == '{';
+  if (braced) start = end = i + 2;
+  while (end < input.size() && (isalnum((unsigned char) input[end]) || input[end] == '_')) end++;
+  if (end == start || (braced && (end >= input.size() || input[end] != '}'))) return 0;
+
+  const char* found = get_var(input.substr(start, end - start));
+  if (found) value = found;
+  if (rc_recording) note_rc_ref(input.substr(start, end - start), found);
+  return end - i + braced;
+}
+
+// 'export NAME=value...' sets and exports variables, 'export NAME...' exports existing
+// ones, and plain 'export' lists every exported variable:
+int handle_export(int argc, char** argv) {
+  if (argc == 1) {
+    std::vector<std::string_view> exported(envp.begin(), envp.end() - (envp.empty() ? 0 : 1));
+    std::sort(exported.begin(), exported.end());
+    for (std::string_view entry : exported) {
+      size_t eq = entry.find('=');
+      printf("export %.*s=\"%s\"\n", (int) eq, entry.data(), entry.data() + eq + 1);
+    }
+    return 0;
+  }
+
+  int status = 0;
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+    size_t eq = std::min(arg.find('='), arg.size());
+    if (!valid_name(arg.substr(0, eq))) {
+      fprintf(stderr, "[export] error: %s: not a valid name.\n", argv[i]);
+      status = 1;
+    }
+    else if (eq < arg.size()) set_var(arg.substr(0, eq), arg.substr(eq + 1), true);
+    else if (const char* value = get_var(arg)) set_var(arg, std::string(value), true);
+  }
+  return status;
+}
+
+int handle_unset(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) unset_var(argv[i]);
+  return 0;
+}
+
+/* ---------- ZYGOTE POOL ---------- */
+
+// starts the zygote master: a fresh (and so small) copy of myShell that keeps
+// zygote_size helpers ready. they are created with CLONE_PARENT, which makes them our
+// children (for the job table) while the forking happens outside the shell:
+void zygote_start() {
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) return;
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    char self[PATH_MAX], fd[16], size[16];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len > 0) {
+      self[len] = '\0';
+      snprintf(fd, sizeof(fd), "%d", sv[1]);
+      snprintf(size, sizeof(size), "%ld", zygote_size);
+      fcntl(sv[1], F_SETFD, 0); // the master's end survives the exec
+      execl(self, "myShell", "--zygote", fd, size, (char*) NULL);
+    }
+    _exit(127);
+  }
+  close(sv[1]);
+  if (pid < 0) close(sv[0]);
+  else zygote_master = {pid, sv[0]};
+}
+
+// stops the master, and with it every idle helper (they exit once their socket closes):
+void zygote_stop() {
+  if (zygote_master.sock >= 0) close(zygote_master.sock);
+  zygote_master = {-1, -1};
+  for (const Zygote& zygote : zygotes) close(zygote.sock);
+  zygotes.clear();
+}
+
+// takes in the helpers the master announced since we last looked (without waiting):
+void zygote_collect() {
+  while (zygote_master.sock >= 0) {
+    pid_t pid;
+    int sock;
+    char control[CMSG_SPACE(sizeof(sock))];
+    struct iovec iov = {&pid, sizeof(pid)};
+    struct msghdr hdr = {};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(zygote_master.sock, &hdr, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      if (n == 0) zygote_stop(); // the master is gone
+      return;
+    }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS) continue;
+    memcpy(&sock, CMSG_DATA(cmsg), sizeof(sock));
+    zygotes.push_back({pid, sock});
+  }
+}
+
+// the master ('myShell --zygote fd n'): starts n helpers, and another one each time
+// the shell asks for it, until the shell goes away:
+int zygote_run_master(int sock, int size) {
+  signal(SIGINT, SIG_IGN);
+  for (int requests = size; requests > 0 || recv(sock, &size, 1, 0) > 0; requests--) {
+    if (requests <= 0) requests = 1;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) return 1;
+
+    // the helper becomes a sibling of ours, so the shell reaps it:
+    pid_t pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+    if (pid == 0) {
+      close(sock);
+      close(sv[0]);
+      zygote_main(sv[1]);
+    }
+    close(sv[1]);
+    if (pid < 0) return 1;
+
+    // tell the shell about it, handing over our end of its socket:
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    struct iovec iov = {&pid, sizeof(pid)};
+    struct msghdr hdr = {};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &sv[0], sizeof(int));
+    ssize_t sent = sendmsg(sock, &hdr, MSG_NOSIGNAL);
+    close(sv[0]);
+    if (sent < 0) return 0;
+  }
+  return 0;
+}
+
+// hands the command to a helper, which becomes its process. -1 if there's no helper or
+// the request doesn't fit in one message (or has more than ZYGOTE_FDS descriptors). like
+// after fork(), the shell doesn't wait for the exec, so the helper reports if it fails:
+pid_t zygote_launch(const char* path, const Launch& launch, const std::vector<std::pair<int, int>>& moves,
+                    bool is_background) {
+  // the request is the header followed by the path, the arguments and the environment:
+  static std::vector<char> msg(ZYGOTE_MSG_MAX);
+  ZygoteRequest req = {};
+  size_t len = sizeof(req);
+  auto pack = [&](const char* s) {
+    size_t n = strlen(s) + 1;
+    if (len + n > msg.size()) return false;
+    memcpy(msg.data() + len, s, n);
+    len += n;
+    return true;
+  };
+  char cwd[PATH_MAX];
+  bool fits = getcwd(cwd, sizeof(cwd)) && pack(path) && pack(cwd);
+  for (req.argc = 0; fits && launch.argv[req.argc]; req.argc++) fits = pack(launch.argv[req.argc]);
+  char** env = command_env(launch);
+  for (req.envc = 0; fits && env[req.envc]; req.envc++) fits = pack(env[req.envc]);
+  zygote_collect();
+  if (!fits || zygotes.empty() || moves.size() > ZYGOTE_FDS) return -1;
+
+  // the stage's descriptors go along with it, and are moved into place by the helper:
+  int fds[ZYGOTE_FDS];
+  for (const auto& move : moves) {
+    fds[req.nfds] = move.second;
+    req.targets[req.nfds++] = move.first;
+  }
+  req.background = is_background;
+  memcpy(msg.data(), &req, sizeof(req));
+
+  struct iovec iov = {msg.data(), len};
+  char control[CMSG_SPACE(sizeof(fds))] = {};
+  struct msghdr hdr = {};
+  hdr.msg_iov = &iov;
+  hdr.msg_iovlen = 1;
+  if (req.nfds) {
+    hdr.msg_control = control;
+    hdr.msg_controllen = CMSG_SPACE(req.nfds * sizeof(int));
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(req.nfds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, req.nfds * sizeof(int));
+  }
+
+  // a helper that died (or was killed) is dropped, and the next one tried. the master
+  // is asked for a replacement of every helper taken:
+  while (!zygotes.empty()) {
+    Zygote zygote = zygotes.back();
+    zygotes.pop_back();
+    ssize_t sent = sendmsg(zygote.sock, &hdr, MSG_NOSIGNAL);
+    close(zygote.sock);
+    send(zygote_master.sock, "", 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent >= 0) return zygote.pid;
+  }
+  return -1;
+}
+
+// the helper: waits for one command, then becomes it:
+void zygote_main(int sock) {
+  // CTRL+C at the prompt is for the shell, not for idle helpers:
+  signal(SIGINT, SIG_IGN);
+  signal(SIGCHLD, SIG_DFL);
+
+  static std::vector<char> msg(ZYGOTE_MSG_MAX);
+  int fds[ZYGOTE_FDS];
+  char control[CMSG_SPACE(sizeof(fds))];
+  struct iovec iov = {msg.data(), msg.size()};
+  struct msghdr hdr = {};
+  hdr.msg_iov = &iov;
+  hdr.msg_iovlen = 1;
+  hdr.msg_control = control;
+  hdr.msg_controllen = sizeof(control);
+  ssize_t len = recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC);
+  while (len < 0 && errno == EINTR) len = recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC);
+  if (len < (ssize_t) sizeof(ZygoteRequest)) _exit(0); // the shell is gone, or shrank the pool
+
+  ZygoteRequest req;
+  memcpy(&req, msg.data(), sizeof(req));
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+  if (req.nfds && cmsg && cmsg->cmsg_type == SCM_RIGHTS) memcpy(fds, CMSG_DATA(cmsg), req.nfds * sizeof(int));
+  else req.nfds = 0;
+
+  // unpack the strings in place:
+  std::vector<char*> argv, env;
+  char* s = msg.data() + sizeof(req);
+  char* path = s;
+  s += strlen(s) + 1;
+  char* cwd = s; // helpers were started elsewhere, and earlier
+  s += strlen(s) + 1;
+  for (int i = 0; i < req.argc; i++, s += strlen(s) + 1) argv.push_back(s);
+  for (int i = 0; i < req.envc; i++, s += strlen(s) + 1) env.push_back(s);
+  argv.push_back(NULL);
+  env.push_back(NULL);
+
+  // everything a freshly spawned process would have:
+  if (req.background) setpgid(0, 0);
+  if (chdir(cwd) == -1) {
+    print_error(2);
+    fflush(stdout);
+    _exit(127);
+  }
+  // the descriptors arrived wherever there was room, which may be another one's target:
+  int above = 0;
+  for (int i = 0; i < req.nfds; i++) above = std::max(above, req.targets[i] + 1);
+  for (int i = 0; i < req.nfds; i++) {
+    int fd = fcntl(fds[i], F_DUPFD_CLOEXEC, above);
+    close(fds[i]);
+    fds[i] = fd;
+  }
+  for (int i = 0; i < req.nfds; i++) dup2(fds[i], req.targets[i]);
+  for (int i = 0; i < req.nfds; i++) close(fds[i]);
+  signal(SIGINT, SIG_DFL);
+  sigset_t none;
+  sigemptyset(&none);
+  sigprocmask(SIG_SETMASK, &none, NULL);
+
+  // stdout is fully buffered, and _exit() doesn't flush it:
+  execve(path, argv.data(), env.data());
+  print_error(1);
+  fflush(stdout);
+  _exit(127);
+}
+
+bool set_zygote(const char* arg) {
+  char* end;
+  long size = strtol(arg, &end, 10);
+  if (end == arg || *end || size < 0 || size > ZYGOTE_MAX) {
+    fprintf(stderr, "[set] error: the zygote pool holds 0 to %d helpers.\n", ZYGOTE_MAX);
+    return false;
+  }
+  zygote_size = size;
+  zygote_stop();
+  if (size) zygote_start();
+  return true;
+}
+
+// 'zygote --stats' reports launches through the pool and posix_spawn() ones:
+int handle_zygote(int argc, char** argv) {
+  if (argc != 2 || strcmp(argv[1], "--stats")) {
+    fprintf(stderr, "[zygote] error: usage: zygote --stats (the pool is sized with 'set zygote N')\n");
+    return 1;
+  }
+  long tries = launch_stats.zygote + launch_stats.zygote_misses;
+  zygote_collect();
+  printf("pool %zu of %ld helpers ready\n", zygotes.size(), zygote_size);
+  printf("zygote launches %ld, misses %ld, hit rate %.1f%%\n", launch_stats.zygote,
+         launch_stats.zygote_misses, tries ? 100.0 * launch_stats.zygote / tries : 0.0);
+  printf("zygote mean handoff latency %.1fus (until a helper has the command, before its exec)\n",
+         launch_stats.zygote ? launch_stats.zygote_us / launch_stats.zygote : 0.0);
+  printf("posix_spawn mean launch latency %.1fus (through the exec, %ld launches)\n",
+         launch_stats.spawned ? launch_stats.spawn_us / launch_stats.spawned : 0.0, launch_stats.spawned);
+  return 0;
+}
+
+/* ---------- COMMAND LOOKUP ---------- */
+
+const char* resolve_cmd(const char* name) {
+  // paths are used as they are, just like execvp() does:
+  if (strchr(name, '/')) return name;
+
+  // (the cache is dropped whenever $PATH is set, see set_var())
+  const char* env_path = getenv("PATH");
+  std::string_view search_path = env_path ? env_path : "/bin:/usr/bin";
+
+  // cache hit, no need to touch the filesystem:
+  auto cached = path_cache.find(name);
+  if (cached != path_cache.end()) {
+    cached->second.hits++;
+    return cached->second.path.c_str();
+  }
+
+  // cache miss: search each directory in $PATH (an empty entry means the current directory):
+  size_t start = 0;
+  while (start <= search_path.size()) {
+    size_t end = search_path.find(':', start);
+    if (end == std::string_view::npos) end = search_path.size();
+    std::string candidate(search_path.substr(start, end-start));
+    candidate += (candidate.empty() ? "./" : "/");
+    candidate += name;
+
+    struct stat st;
+    if (stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(candidate.c_str(), X_OK) == 0) {
+      HashedPath& entry = path_cache[name];
+      entry.path = candidate;
+      entry.hits = 1;
+      return entry.path.c_str();
+    }
+    start = end+1;
+  }
+  return NULL;
+}
+
+int handle_hash(int argc, char** argv) {
+  // 'hash -r' forgets every remembered location:
+  if (argc > 1 && !strcmp(argv[1], "-r")) {
+    path_cache.clear();
+    return 0;
+  }
+
+  // 'hash name...' looks up and remembers the given commands:
+  if (argc > 1) {
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+      if (resolve_cmd(argv[i])) continue;
+      fprintf(stderr, "[hash] error: %s not found.\n", argv[i]);
+      status = 1;
+    }
+    return status;
+  }
+
+  // plain 'hash' prints the table, like bash does:
+  if (path_cache.empty()) {
+    printf("hash: hash table empty\n");
+    return 0;
+  }
+  printf("hits\tcommand\n");
+  for (const auto& entry : path_cache) {
+    printf("%4d\t%s\n", entry.second.hits, entry.second.path.c_str());
+  }
+  return 0;
+}
+
+/* ---------- SHELL OPTIONS ---------- */
+
+int handle_set(int argc, char** argv) {
+  // plain 'set' lists every option with its current value:
+  if (argc == 1) {
+    for (const auto& option : OPTIONS) {
+      printf("%s\t", option.first.c_str());
+      print_size(*option.second.value);
+    }
+    return 0;
+  }
+
+  auto option = argc == 3 ? OPTIONS.find(argv[1]) : OPTIONS.end();
+  if (argc != 3) fprintf(stderr, "[set] error: usage: set [option value]\n");
+  else if (option == OPTIONS.end()) fprintf(stderr, "[set] error: no such option %s.\n", argv[1]);
+  else if (option->second.set(argv[2])) return 0;
+  return 1;
+}
+
+// parses a byte count with an optional K, M or G suffix (e.g. '1M'):
+bool parse_size(const char* arg, long& size) {
+  char* end;
+  size = strtol(arg, &end, 10);
+  if (end == arg || size < 0) return false;
+  switch (*end) {
+    case 'k': case 'K': size <<= 10; end++; break;
+    case 'm': case 'M': size <<= 20; end++; break;
+    case 'g': case 'G': size <<= 30; end++; break;
+  }
+  return *end == '\0';
+}
+
+bool set_pipesize(const char* arg) {
+  long size;
+  if (!parse_size(arg, size) || size > INT_MAX) {
+    fprintf(stderr, "[set] error: invalid pipe size %s.\n", arg);
+    return false;
+  }
+
+  // only privileged processes may go past the system-wide limit, others are clamped:
+  long max = pipe_max_size();
+  if (max > 0 && size > max && geteuid() != 0) {
+    fprintf(stderr, "[set] warning: pipe size clamped to %ldK by /proc/sys/fs/pipe-max-size.\n",
+            max / 1024);
+    size = max;
+  }
+  pipe_size = size;
+  return true;
+}
+
+bool set_fanout(const char* arg) {
+  char* end;
+  long hosts = strtol(arg, &end, 10);
+  if (end == arg || *end || hosts < 1) {
+    fprintf(stderr, "[set] error: invalid fan-out %s.\n", arg);
+    return false;
+  }
+  fanout = hosts;
+  return true;
+}
+
+bool set_memosize(const char* arg) {
+  long size;
+  if (!parse_size(arg, size)) {
+    fprintf(stderr, "[set] error: invalid memo cache size %s.\n", arg);
+    return false;
+  }
+  memo_size = size;
+  memo_evict(memo_dir());
+  return true;
+}
+
+void print_size(long size) {
+  if (size && size % (1 << 20) == 0) printf("%ldM\n", size >> 20);
+  else if (size && size % (1 << 10) == 0) printf("%ldK\n", size >> 10);
+  else printf("%ld\n", size);
+}
+
+// the largest capacity an unprivileged process may give a pipe, -1 if unknown:
+long pipe_max_size() {
+  FILE* file = fopen("/proc/sys/fs/pipe-max-size", "r");
+  if (!file) return -1;
+  long max = -1;
+  if (fscanf(file, "%ld", &max) != 1) max = -1;
+  fclose(file);
+  return max;
+}
+
+/* ---------- UTILITY FUNCTIONS ---------- */
+
 void clear_screen() {
   #ifdef WINDOWS
   std::system("cls");